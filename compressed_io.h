@@ -0,0 +1,771 @@
+/*****************************************************************/
+/*                                                               */
+/*   Reading and writing compressed generator files. Input       */
+/*   files compressed with gzip (.gz), zstd (.zst) or xz (.xz)   */
+/*   are recognised from their first bytes, whatever they're     */
+/*   called, and read as if they'd been decompressed first.      */
+/*                                                               */
+/*   A plain file is memory-mapped as before. A compressed one   */
+/*   is decompressed by a thread of its own into blocks of       */
+/*   DECOMPRESS_BLOCK bytes, which are handed to the reader      */
+/*   through a queue of at most DECOMPRESS_QUEUE blocks, so the  */
+/*   next block is being decompressed while the current one is   */
+/*   parsed. The blocks are recycled, so the memory used stays   */
+/*   the same whatever the size of the file.                     */
+/*                                                               */
+/*   Usage, from a macro:                                        */
+/*     #include "compressed_io.h"                                */
+/*                                                               */
+/*     TextInput input;                                          */
+/*     if (input.open(filename)){                                */
+/*       input.start_range(0, TEXT_END);   // all of it          */
+/*       const char *b, *e;                                      */
+/*       while (input.next(b,e)){ ... read_int(b,e,i) ... }      */
+/*     }                                                         */
+/*                                                               */
+/*   Offsets (input.line_offset, the event index...) count bytes */
+/*   of the decompressed text. A compressed file can only be     */
+/*   read forward: start_range can skip ahead, but not go back.  */
+/*                                                               */
+/*   TextCompressor does the opposite for output files, see      */
+/*   BufferedWriter in lund_router.h.                            */
+/*                                                               */
+/*   zlib, libzstd and liblzma are loaded with gSystem->Load, by */
+/*   allow_compressed_input from the main thread before any file */
+/*   is read, or the first time a file is written compressed:    */
+/*   ROOT built with its own copies of them (builtin_zlib... as  */
+/*   in the binary and conda releases) needn't make their        */
+/*   symbols visible to macros. If the header of one of them     */
+/*   isn't found when the macro is compiled, or its library      */
+/*   can't be loaded, that format is reported as not supported.  */
+/*                                                               */
+/*   This has only been tried with the macros compiled as plain  */
+/*   C++ and linked against the system's zlib 1.2, zstd 1.5 and  */
+/*   xz 5.4, not yet inside ROOT (interpreted or with ACLiC),    */
+/*   where ROOT's own copies of the libraries are loaded         */
+/*   already. Until it has been, reading compressed input is off */
+/*   unless a macro is told otherwise (read_compressed = 1 at    */
+/*   the top of it), and compressed files are skipped with a     */
+/*   message.                                                    */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef COMPRESSED_IO_H
+#define COMPRESSED_IO_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TSystem.h"
+#include "line_reader.h"
+
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define COMPRESSED_IO_GZIP 1
+#endif
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#define COMPRESSED_IO_ZSTD 1
+#endif
+#if __has_include(<lzma.h>)
+#include <lzma.h>
+#define COMPRESSED_IO_XZ 1
+#endif
+
+enum { PLAIN_TEXT = 0, GZIP_TEXT = 1, ZSTD_TEXT = 2, XZ_TEXT = 3 };
+
+enum { DECOMPRESS_BLOCK = 1<<22,   // 4 MB of decompressed text per block
+       DECOMPRESS_QUEUE = 4 };     // blocks decompressed ahead of the reader, at most
+
+const uint64_t TEXT_END = UINT64_MAX;   // end of a range that goes on to the end of the text, however long it is
+
+
+// How a file is compressed, from its first bytes. PLAIN_TEXT if it isn't (or can't be opened).
+
+inline int text_compression(const char *filename){
+  unsigned char magic[6] = {};
+  FILE *f = fopen(filename, "rb");
+  if (!f) return PLAIN_TEXT;
+  size_t n = fread(magic, 1, sizeof(magic), f);
+  fclose(f);
+  if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return GZIP_TEXT;
+  if (n >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) return ZSTD_TEXT;
+  if (n >= 6 && memcmp(magic, "\xfd" "7zXZ\0", 6) == 0) return XZ_TEXT;
+  return PLAIN_TEXT;
+}
+
+inline const char* compression_name(int compression){
+  switch (compression){
+  case GZIP_TEXT: return "gzip";
+  case ZSTD_TEXT: return "zstd";
+  case XZ_TEXT: return "xz";
+  }
+  return "none";
+}
+
+// what's added to the end of the name of a file written with this compression
+inline const char* compression_suffix(int compression){
+  switch (compression){
+  case GZIP_TEXT: return ".gz";
+  case ZSTD_TEXT: return ".zst";
+  case XZ_TEXT: return ".xz";
+  }
+  return "";
+}
+
+// library of each format, as given to gSystem->Load
+inline const char* compression_library(int compression){
+  switch (compression){
+  case GZIP_TEXT: return "libz";
+  case ZSTD_TEXT: return "libzstd";
+  case XZ_TEXT: return "liblzma";
+  }
+  return "";
+}
+
+// Loads the library of a format, once, the first time it's asked for (from whichever thread). Returns false if it can't be
+// loaded, with a message the first time.
+inline bool load_compression_library(int compression){
+  static std::mutex lock;
+  static int loaded[4] = {};   // 0: not tried yet, 1: loaded, -1: can't be
+  std::lock_guard<std::mutex> guard(lock);
+  if (loaded[compression] == 0){
+    loaded[compression] = gSystem->Load(compression_library(compression)) >= 0 ? 1 : -1;
+    if (loaded[compression] < 0) std::cout << "Crap, can't load " << compression_library(compression) << ", so " << compression_name(compression) << " files can't be read or written!" << std::endl;
+  }
+  return loaded[compression] == 1;
+}
+
+inline bool compression_supported(int compression){
+  switch (compression){
+  case PLAIN_TEXT: return true;
+#ifdef COMPRESSED_IO_GZIP
+  case GZIP_TEXT: return load_compression_library(GZIP_TEXT);
+#endif
+#ifdef COMPRESSED_IO_ZSTD
+  case ZSTD_TEXT: return load_compression_library(ZSTD_TEXT);
+#endif
+#ifdef COMPRESSED_IO_XZ
+  case XZ_TEXT: return load_compression_library(XZ_TEXT);
+#endif
+  }
+  return false;
+}
+
+// Reading compressed input is off unless a macro turns it on, see the top of this file.
+inline bool &compressed_input_allowed(){
+  static bool allowed = false;
+  return allowed;
+}
+
+// Turns reading compressed input on or off for the files opened from now on. To be called from the main thread before any
+// file is read, so the libraries of the formats that are supported are loaded there, rather than by whichever thread comes
+// across a file in their format first.
+inline void allow_compressed_input(bool allowed){
+  compressed_input_allowed() = allowed;
+  if (allowed) for (int c=GZIP_TEXT; c<=XZ_TEXT; c++) compression_supported(c);
+}
+
+
+// A block of decompressed text.
+
+struct TextBlock {
+  std::unique_ptr<char[]> data;   // not zeroed, as it's only ever read up to size
+  size_t capacity = 0;
+  size_t size = 0;
+};
+
+
+// Blocks going from the decompressing thread (put_full) to the reader (get_full) and back again once read (put_empty), so
+// there are never more than the blocks made at the start. Either side waits if the other one is behind.
+
+struct BlockQueue {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<TextBlock*> full, empty;
+  bool done = false;        // no more blocks will be filled
+  bool cancelled = false;   // the reader doesn't want any more
+
+  // decompressing side:
+  TextBlock* get_empty(){
+    std::unique_lock<std::mutex> l(lock);
+    changed.wait(l, [this]{ return cancelled || !empty.empty(); });
+    if (cancelled) return nullptr;
+    TextBlock *block = empty.front();
+    empty.pop_front();
+    block->size = 0;
+    return block;
+  }
+
+  void put_full(TextBlock *block){
+    std::lock_guard<std::mutex> l(lock);
+    full.push_back(block);
+    changed.notify_all();
+  }
+
+  void finish(){
+    std::lock_guard<std::mutex> l(lock);
+    done = true;
+    changed.notify_all();
+  }
+
+  // reading side. get_full returns nullptr once all the blocks have been read.
+  TextBlock* get_full(){
+    std::unique_lock<std::mutex> l(lock);
+    changed.wait(l, [this]{ return done || !full.empty(); });
+    if (full.empty()) return nullptr;
+    TextBlock *block = full.front();
+    full.pop_front();
+    return block;
+  }
+
+  void put_empty(TextBlock *block){
+    std::lock_guard<std::mutex> l(lock);
+    empty.push_back(block);
+    changed.notify_all();
+  }
+
+  void cancel(){
+    std::lock_guard<std::mutex> l(lock);
+    cancelled = true;
+    changed.notify_all();
+  }
+};
+
+
+// One step of decompression of each format: takes what it can of the nin bytes at in and writes up to nout bytes to out,
+// moving the pointers and counts on. eof says the input has all been read. Returns 1 when a complete stream (or frame)
+// has been decompressed and all of it written out, -1 on an error (message in error), 0 otherwise.
+
+struct Inflater {
+  int format;
+  std::string error;
+#ifdef COMPRESSED_IO_GZIP
+  z_stream zs = {};
+#endif
+#ifdef COMPRESSED_IO_ZSTD
+  ZSTD_DStream *zds = nullptr;
+#endif
+#ifdef COMPRESSED_IO_XZ
+  lzma_stream xzs = LZMA_STREAM_INIT;
+#endif
+
+  Inflater(int f) : format(f) {}
+
+  bool begin(){
+    switch (format){
+#ifdef COMPRESSED_IO_GZIP
+    case GZIP_TEXT: return inflateInit2(&zs, 15 + 32) == Z_OK;   // 32: gzip header expected
+#endif
+#ifdef COMPRESSED_IO_ZSTD
+    case ZSTD_TEXT:
+      zds = ZSTD_createDStream();
+      return zds && !ZSTD_isError(ZSTD_initDStream(zds));
+#endif
+#ifdef COMPRESSED_IO_XZ
+    case XZ_TEXT: return lzma_stream_decoder(&xzs, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+#endif
+    }
+    return false;
+  }
+
+  int step(const char *&in, size_t &nin, char *&out, size_t &nout, bool eof){
+    switch (format){
+#ifdef COMPRESSED_IO_GZIP
+    case GZIP_TEXT: {
+      zs.next_in = (Bytef*)in;
+      zs.avail_in = nin;
+      zs.next_out = (Bytef*)out;
+      zs.avail_out = nout;
+      int ret = inflate(&zs, Z_NO_FLUSH);
+      in = (const char*)zs.next_in;
+      nin = zs.avail_in;
+      out = (char*)zs.next_out;
+      nout = zs.avail_out;
+      if (ret == Z_STREAM_END){
+	if (nin > 0 || !eof) inflateReset(&zs);   // files made with cat a.gz b.gz hold one gzip stream after the other
+	return 1;
+      }
+      if (ret == Z_OK || ret == Z_BUF_ERROR) return 0;
+      error = zs.msg ? zs.msg : "zlib error " + std::to_string(ret);
+      return -1;
+    }
+#endif
+#ifdef COMPRESSED_IO_ZSTD
+    case ZSTD_TEXT: {
+      ZSTD_inBuffer ib = {in, nin, 0};
+      ZSTD_outBuffer ob = {out, nout, 0};
+      size_t ret = ZSTD_decompressStream(zds, &ob, &ib);
+      in += ib.pos;
+      nin -= ib.pos;
+      out += ob.pos;
+      nout -= ob.pos;
+      if (ZSTD_isError(ret)){
+	error = ZSTD_getErrorName(ret);
+	return -1;
+      }
+      return ret == 0 ? 1 : 0;
+    }
+#endif
+#ifdef COMPRESSED_IO_XZ
+    case XZ_TEXT: {
+      xzs.next_in = (const uint8_t*)in;
+      xzs.avail_in = nin;
+      xzs.next_out = (uint8_t*)out;
+      xzs.avail_out = nout;
+      lzma_ret ret = lzma_code(&xzs, eof ? LZMA_FINISH : LZMA_RUN);
+      in = (const char*)xzs.next_in;
+      nin = xzs.avail_in;
+      out = (char*)xzs.next_out;
+      nout = xzs.avail_out;
+      if (ret == LZMA_STREAM_END) return 1;
+      if (ret == LZMA_OK || ret == LZMA_BUF_ERROR) return 0;
+      error = "liblzma error " + std::to_string((int)ret);
+      return -1;
+    }
+#endif
+    }
+    error = "not supported";
+    return -1;
+  }
+
+  ~Inflater(){
+#ifdef COMPRESSED_IO_GZIP
+    if (format == GZIP_TEXT) inflateEnd(&zs);
+#endif
+#ifdef COMPRESSED_IO_ZSTD
+    if (zds) ZSTD_freeDStream(zds);
+#endif
+#ifdef COMPRESSED_IO_XZ
+    if (format == XZ_TEXT) lzma_end(&xzs);
+#endif
+  }
+};
+
+
+// Decompresses a file on a thread of its own, into the blocks of its queue.
+
+struct Decompressor {
+  int format;
+  int fd = -1;
+  BlockQueue queue;
+  std::vector<TextBlock> blocks;
+  std::thread thread;
+  std::string error;        // what went wrong, if anything, once the last block has been read
+  uint64_t ncompressed = 0; // bytes of the file read in
+
+  Decompressor(int f) : format(f) {}
+
+  bool start(const char *filename){
+    fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    blocks.resize(DECOMPRESS_QUEUE + 1);   // one more for the block being read
+    for (auto &block : blocks){
+      block.data.reset(new char[DECOMPRESS_BLOCK]);
+      block.capacity = DECOMPRESS_BLOCK;
+      queue.empty.push_back(&block);
+    }
+    thread = std::thread([this]{ run(); });
+    return true;
+  }
+
+  void run(){
+
+    Inflater inflater(format);
+    if (!inflater.begin()){
+      error = "can't start decompressing";
+      queue.finish();
+      return;
+    }
+
+    const size_t insize = 1<<20;
+    std::unique_ptr<char[]> inbuf(new char[insize]);
+    const char *in = inbuf.get();
+    size_t nin = 0;
+    bool eof = false;
+    bool complete = false;   // the last stream in the file has been decompressed to the end
+
+    TextBlock *block = queue.get_empty();
+
+    while (block){
+
+      if (nin == 0 && !eof){
+	ssize_t n = ::read(fd, inbuf.get(), insize);
+	if (n < 0){
+	  error = "can't read the file";
+	  break;
+	}
+	eof = (n == 0);
+	in = inbuf.get();
+	nin = n;
+	ncompressed += n;
+      }
+
+      if (block->size == block->capacity){
+	queue.put_full(block);
+	block = queue.get_empty();
+	if (!block) break;   // the reader stopped
+      }
+
+      char *out = block->data.get() + block->size;
+      size_t nout = block->capacity - block->size;
+      size_t nin_before = nin, nout_before = nout;
+
+      int ret = inflater.step(in, nin, out, nout, eof);
+      block->size = block->capacity - nout;
+
+      if (ret < 0){
+	error = inflater.error;
+	break;
+      }
+
+      bool progress = (nin != nin_before || nout != nout_before);
+      if (ret == 1) complete = true;
+      else if (progress) complete = false;
+
+      if (eof && nin == 0 && (ret == 1 || !progress)) break;   // nothing left to read or to write out
+    }
+
+    if (error.empty() && block && !complete) error = "the file is cut short";
+
+    if (block && block->size > 0) queue.put_full(block);
+    else if (block) queue.put_empty(block);
+    queue.finish();
+  }
+
+  // stops the thread, whether or not the whole file has been read
+  void stop(){
+    queue.cancel();
+    if (thread.joinable()) thread.join();
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+  }
+
+  ~Decompressor(){ stop(); }
+};
+
+
+// Lines of a text file, plain or compressed, read in ranges of bytes [begin,end) of the (decompressed) text.
+// Each line is given as [b,e), without the trailing "\n" (or "\r\n"), and line_offset is set to where it starts.
+
+struct TextInput {
+  std::string filename;
+  int compression = PLAIN_TEXT;
+  uint64_t line_offset = 0;   // offset of the last line given by next()
+  uint64_t nbytes = 0;        // bytes of text read in, newlines included
+
+  // plain files:
+  MappedFile file;
+  LineReader lines = LineReader(nullptr, 0);
+
+  // compressed files:
+  Decompressor *stream = nullptr;
+  TextBlock *block = nullptr;        // block being read, [pos,end) still to go
+  const char *pos = nullptr, *end = nullptr;
+  uint64_t block_offset = 0;         // offset of the start of the block
+  std::vector<char> carry;           // line that runs over from one block to the next
+  uint64_t carry_offset = 0;
+  bool carry_given = false;          // carry has been handed out as a line, to be cleared on the next call
+  bool stream_done = false;
+  bool failed = false;               // the decompression stopped on an error (a corrupt or cut short file), see next
+  uint64_t range_begin = 0, range_end = 0;
+  bool have_pending = false;         // a line read past the end of the last range, kept for the next one
+  const char *pending_b = nullptr, *pending_e = nullptr;
+  uint64_t pending_offset = 0, pending_after = 0;
+
+  bool open(const char *name){
+    close();
+    filename = name;
+    compression = text_compression(name);
+    if (compression == PLAIN_TEXT) return file.open(name);
+    if (!compressed_input_allowed()){
+      std::cout << "Crap, " << name << " is compressed with " << compression_name(compression) << ", and reading compressed files is off "
+		<< "(set read_compressed = 1 to try it)! Decompress it first." << std::endl;
+      return false;
+    }
+    if (!compression_supported(compression)){
+      std::cout << "Crap, " << name << " is compressed with " << compression_name(compression) << ", which isn't supported here! Decompress it first." << std::endl;
+      return false;
+    }
+    stream = new Decompressor(compression);
+    if (!stream->start(name)){
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  // Lines from here on come from bytes [begin,end) of the text. Ranges have to come in order. Returns false if the range
+  // goes past the end of a plain file, ie. it doesn't belong to this file.
+  bool start_range(uint64_t begin, uint64_t range_to){
+    if (!stream){
+      if (range_to == TEXT_END) range_to = file.size;
+      if (begin > range_to || range_to > file.size) return false;
+      lines = LineReader(file.data + begin, range_to - begin);
+      return true;
+    }
+    range_begin = begin;
+    range_end = range_to;
+    return true;
+  }
+
+  bool next(const char *&b, const char *&e){
+
+    if (!stream){
+      if (!lines.next(b,e)) return false;
+      line_offset = b - file.data;
+      nbytes += lines.pos - b;
+      return true;
+    }
+
+    uint64_t offset, after;
+    while (true){
+      if (have_pending){
+	b = pending_b;
+	e = pending_e;
+	offset = pending_offset;
+	after = pending_after;
+	have_pending = false;
+      }
+      else if (!next_line(b, e, offset, after)) return false;
+
+      if (offset < range_begin) continue;   // skipping ahead to the start of the range
+      if (offset >= range_end){             // past the end: keep it in case the next range starts with it
+	have_pending = true;
+	pending_b = b;
+	pending_e = e;
+	pending_offset = offset;
+	pending_after = after;
+	return false;
+      }
+      line_offset = offset;
+      nbytes += after - offset;
+      return true;
+    }
+  }
+
+  // Size of the whole text. For a compressed file that means decompressing the rest of it.
+  uint64_t text_size(){
+    if (!stream) return file.size;
+    const char *b, *e;
+    uint64_t offset, after;
+    have_pending = false;
+    while (next_line(b, e, offset, after)) {}
+    return block_offset;
+  }
+
+  void close(){
+    if (stream){
+      if (block) stream->queue.put_empty(block);
+      stream->stop();
+      delete stream;
+    }
+    stream = nullptr;
+    block = nullptr;
+    pos = end = nullptr;
+    block_offset = 0;
+    failed = false;
+    carry.clear();
+    carry_given = false;
+    stream_done = false;
+    have_pending = false;
+    range_begin = range_end = 0;
+    file.close();
+    lines = LineReader(nullptr, 0);
+    line_offset = 0;
+    nbytes = 0;
+  }
+
+  ~TextInput(){ close(); }
+
+  // Next line of the decompressed text, whatever the ranges. offset is where it starts, after where the next one does.
+  bool next_line(const char *&b, const char *&e, uint64_t &offset, uint64_t &after){
+
+    if (carry_given){
+      carry.clear();
+      carry_given = false;
+    }
+
+    while (true){
+
+      if (block && pos < end){
+	const char *nl = (const char*)memchr(pos, '\n', end - pos);
+	if (nl){
+	  if (carry.empty()){
+	    b = pos;
+	    e = nl;
+	    offset = block_offset + (pos - block->data.get());
+	  }
+	  else {
+	    carry.insert(carry.end(), pos, nl);
+	    b = carry.data();
+	    e = b + carry.size();
+	    offset = carry_offset;
+	    carry_given = true;
+	  }
+	  pos = nl + 1;
+	  after = block_offset + (pos - block->data.get());
+	  if (e > b && *(e-1) == '\r') e--;
+	  return true;
+	}
+	// no end of line in the rest of the block: it goes on in the next one
+	if (carry.empty()) carry_offset = block_offset + (pos - block->data.get());
+	carry.insert(carry.end(), pos, end);
+	pos = end;
+      }
+
+      if (stream_done) return false;
+
+      if (block){
+	block_offset += block->size;
+	stream->queue.put_empty(block);
+	block = nullptr;
+      }
+
+      block = stream->queue.get_full();
+
+      if (!block){   // end of the file
+	stream_done = true;
+	if (!stream->error.empty()){
+	  std::cout << "Crap, can't decompress " << filename << ": " << stream->error << "!" << std::endl;
+	  failed = true;
+	}
+	if (carry.empty()) return false;
+	b = carry.data();   // last line without a newline at the end
+	e = b + carry.size();
+	offset = carry_offset;
+	after = block_offset;
+	carry_given = true;
+	if (e > b && *(e-1) == '\r') e--;
+	return true;
+      }
+
+      pos = block->data.get();
+      end = pos + block->size;
+    }
+  }
+};
+
+
+// Compresses the text of an output file as it's written. compress() hands the compressed bytes to write() as they come.
+
+struct TextCompressor {
+  int format = PLAIN_TEXT;
+  std::vector<char> out;
+  std::string error;
+#ifdef COMPRESSED_IO_GZIP
+  z_stream zs = {};
+#endif
+#ifdef COMPRESSED_IO_ZSTD
+  ZSTD_CStream *zcs = nullptr;
+#endif
+#ifdef COMPRESSED_IO_XZ
+  lzma_stream xzs = LZMA_STREAM_INIT;
+#endif
+
+  // level -1 is the usual level of each format: 6 for gzip and xz, 3 for zstd
+  bool begin(int f, int level = -1){
+    end();
+    format = f;
+    if (!compression_supported(format)){
+      format = PLAIN_TEXT;
+      return false;
+    }
+    out.resize(1<<20);
+    switch (format){
+#ifdef COMPRESSED_IO_GZIP
+    case GZIP_TEXT: return deflateInit2(&zs, level < 0 ? 6 : level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;   // 16: gzip header
+#endif
+#ifdef COMPRESSED_IO_ZSTD
+    case ZSTD_TEXT:
+      zcs = ZSTD_createCStream();
+      return zcs && !ZSTD_isError(ZSTD_initCStream(zcs, level < 0 ? 3 : level));
+#endif
+#ifdef COMPRESSED_IO_XZ
+    case XZ_TEXT: return lzma_easy_encoder(&xzs, level < 0 ? 6 : level, LZMA_CHECK_CRC64) == LZMA_OK;
+#endif
+    }
+    format = PLAIN_TEXT;
+    return false;
+  }
+
+  bool compress(const char *data, size_t n, bool finish, const std::function<void(const char*, size_t)> &write){
+    switch (format){
+#ifdef COMPRESSED_IO_GZIP
+    case GZIP_TEXT: {
+      zs.next_in = (Bytef*)data;
+      zs.avail_in = n;
+      int ret;
+      do {
+	zs.next_out = (Bytef*)out.data();
+	zs.avail_out = out.size();
+	ret = deflate(&zs, finish ? Z_FINISH : Z_NO_FLUSH);
+	if (ret == Z_STREAM_ERROR) return false;
+	write(out.data(), out.size() - zs.avail_out);
+      } while (zs.avail_out == 0 || (finish && ret != Z_STREAM_END));
+      return true;
+    }
+#endif
+#ifdef COMPRESSED_IO_ZSTD
+    case ZSTD_TEXT: {
+      ZSTD_inBuffer ib = {data, n, 0};
+      size_t left;
+      do {
+	ZSTD_outBuffer ob = {out.data(), out.size(), 0};
+	left = ZSTD_compressStream2(zcs, &ob, &ib, finish ? ZSTD_e_end : ZSTD_e_continue);
+	if (ZSTD_isError(left)){
+	  error = ZSTD_getErrorName(left);
+	  return false;
+	}
+	write(out.data(), ob.pos);
+      } while (ib.pos < ib.size || (finish && left > 0));
+      return true;
+    }
+#endif
+#ifdef COMPRESSED_IO_XZ
+    case XZ_TEXT: {
+      xzs.next_in = (const uint8_t*)data;
+      xzs.avail_in = n;
+      lzma_ret ret;
+      do {
+	xzs.next_out = (uint8_t*)out.data();
+	xzs.avail_out = out.size();
+	ret = lzma_code(&xzs, finish ? LZMA_FINISH : LZMA_RUN);
+	if (ret != LZMA_OK && ret != LZMA_STREAM_END) return false;
+	write(out.data(), out.size() - xzs.avail_out);
+      } while (xzs.avail_in > 0 || xzs.avail_out == 0 || (finish && ret != LZMA_STREAM_END));
+      return true;
+    }
+#endif
+    }
+    write(data, n);   // plain text
+    return true;
+  }
+
+  void end(){
+#ifdef COMPRESSED_IO_GZIP
+    if (format == GZIP_TEXT) deflateEnd(&zs);
+#endif
+#ifdef COMPRESSED_IO_ZSTD
+    if (zcs) ZSTD_freeCStream(zcs);
+    zcs = nullptr;
+#endif
+#ifdef COMPRESSED_IO_XZ
+    if (format == XZ_TEXT) lzma_end(&xzs);
+#endif
+    format = PLAIN_TEXT;
+  }
+
+  ~TextCompressor(){ end(); }
+};
+
+#endif
@@ -0,0 +1,317 @@
+/*****************************************************************/
+/*                                                               */
+/*   Index of where each event starts in a generator file, so    */
+/*   that a macro can go straight to event N instead of reading  */
+/*   the file from the start. This is what's used to read in a   */
+/*   range of events, a random sample of them, or to split one   */
+/*   big file into chunks that are converted at the same time.   */
+/*                                                               */
+/*   The index is built in one pass over the file and saved      */
+/*   next to it, as <file>.evtidx. It's only re-used as long as  */
+/*   the size and modification time of the file haven't changed, */
+/*   otherwise it's rebuilt (and written to a temporary file     */
+/*   first, then renamed). If the directory isn't writable the   */
+/*   index is just kept in memory for the current run.           */
+/*                                                               */
+/*   For compressed files (see compressed_io.h) the offsets are  */
+/*   in the decompressed text, and the file can't be split into  */
+/*   chunks, as each chunk would have to decompress all of the   */
+/*   file before it.                                             */
+/*                                                               */
+/*   Sidecar layout (native byte order):                         */
+/*     char     magic[8]      "EVTIDX2"                          */
+/*     uint32_t format        HEPMC_FORMAT or LUND_FORMAT        */
+/*     uint32_t unused                                           */
+/*     uint64_t file_size     as on disk                         */
+/*     int64_t  mtime         in ns                              */
+/*     uint64_t text_size     once decompressed                  */
+/*     uint64_t n             number of offsets, events + 1      */
+/*     uint64_t offsets[n]                                       */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef EVENT_INDEX_H
+#define EVENT_INDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "compressed_io.h"
+#include "file_list.h"
+
+enum { HEPMC_FORMAT = 1, LUND_FORMAT = 2 };
+
+const int LUND_MAX_PARTICLES = 10000;   // more particles than this in a LUND header is taken to be a corrupt line
+
+
+// offsets[i] is the byte where event i starts, for i < nevents(). The last entry is where the last event ends:
+// the start of the end-of-file text in HepMC files (the "T" line or the end of listing), the end of the text for LUND.
+// Everything before offsets[0] is the header of the file.
+
+struct EventIndex {
+  uint64_t file_size = 0;
+  int64_t mtime = 0;
+  uint64_t text_size = 0;   // the same as file_size, unless the file is compressed
+  std::vector<uint64_t> offsets;
+
+  long nevents() const { return offsets.empty() ? 0 : (long)offsets.size() - 1; }
+};
+
+
+// A stretch of a file made of whole events: bytes [begin,end) of its text, which hold nevents events.
+
+struct EventRange {
+  uint64_t begin;
+  uint64_t end;
+  long nevents;
+};
+
+
+// One piece of work: file number "file" in the list, or part of it. If whole_file is set, the file is read in from start
+// to end, otherwise only the ranges are read in. Shard 0 of each file also
+// gets the header and end-of-file text of the file (as ranges with no events in them), so the file attributes such as
+// the cross-section are only counted once.
+
+struct FileTask {
+  int file = 0;
+  int shard = 0;
+  bool whole_file = false;
+  std::vector<EventRange> ranges;
+};
+
+
+inline std::string index_file_name(const char *filename){
+  return std::string(filename) + ".evtidx";
+}
+
+inline bool file_stamp(const char *filename, uint64_t &size, int64_t &mtime){
+  struct stat st;
+  if (stat(filename, &st) != 0) return false;
+  size = st.st_size;
+  mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  return true;
+}
+
+
+// One pass over the file contents to find where each event starts.
+// HepMC3: every "E" line starts an event. LUND: every header line does, and its first number says how many particle
+// lines follow it -- the same thing process_file in root_from_lund.C relies on with p == ivar[0].
+
+inline void build_index(TextInput &input, int format, EventIndex &index){
+
+  index.offsets.clear();
+
+  input.start_range(0, TEXT_END);
+  const char *b, *e;
+  uint64_t trailer = TEXT_END;
+
+  if (format == HEPMC_FORMAT){
+    while (input.next(b,e)){
+      if (e - b < 2 || b[1] != ' '){
+	if (!index.offsets.empty() && *b == 'H'){   // "HepMC::Asciiv3-END_EVENT_LISTING"
+	  trailer = input.line_offset;
+	  break;
+	}
+	continue;
+      }
+      if (*b == 'E') index.offsets.push_back(input.line_offset);
+      else if (*b == 'T' && !index.offsets.empty()){   // tool info at the end of EpIC files, followed by the run attributes
+	trailer = input.line_offset;
+	break;
+      }
+    }
+  }
+  else {
+    int skip = 0;   // particle lines still to come in the current event
+    while (input.next(b,e)){
+      const char *p = skip_blanks(b,e);
+      if (p == e) continue;   // blank line
+      if (skip > 0){
+	skip--;
+	continue;
+      }
+      int npart = 0;
+      if (!read_int(p,e,npart) || npart <= 0 || npart > LUND_MAX_PARTICLES){
+	std::cout << "Can't make sense of LUND header line at byte " << input.line_offset << ", stopping the index there." << std::endl;
+	trailer = input.line_offset;
+	break;
+      }
+      index.offsets.push_back(input.line_offset);
+      skip = npart;
+    }
+  }
+
+  index.text_size = input.text_size();
+  index.offsets.push_back(trailer == TEXT_END ? index.text_size : trailer);
+}
+
+
+inline bool read_index(const char *idxname, int format, EventIndex &index){
+
+  FILE *f = fopen(idxname, "rb");
+  if (!f) return false;
+
+  char magic[8];
+  uint32_t fmt, unused;
+  uint64_t n;
+  bool ok = fread(magic,1,8,f) == 8 && memcmp(magic,"EVTIDX2",8) == 0 &&
+    fread(&fmt,4,1,f) == 1 && fread(&unused,4,1,f) == 1 && fmt == (uint32_t)format &&
+    fread(&index.file_size,8,1,f) == 1 && fread(&index.mtime,8,1,f) == 1 && fread(&index.text_size,8,1,f) == 1 &&
+    fread(&n,8,1,f) == 1 && n > 0;
+  if (ok){
+    index.offsets.resize(n);
+    ok = fread(index.offsets.data(),8,n,f) == n;
+  }
+  fclose(f);
+
+  return ok;
+}
+
+
+// The sidecar is written to a temporary file of this process and renamed into place once it's complete, so a run reading it
+// at the same time, or one after a crash halfway through, never sees half of it.
+
+inline bool write_index(const char *idxname, int format, const EventIndex &index){
+
+  std::string tmpname = std::string(idxname) + ".tmp" + std::to_string(getpid());
+  FILE *f = fopen(tmpname.c_str(), "wb");
+  if (!f) return false;
+
+  uint32_t fmt = format, unused = 0;
+  uint64_t n = index.offsets.size();
+  bool ok = fwrite("EVTIDX2",1,8,f) == 8 && fwrite(&fmt,4,1,f) == 1 && fwrite(&unused,4,1,f) == 1 &&
+    fwrite(&index.file_size,8,1,f) == 1 && fwrite(&index.mtime,8,1,f) == 1 && fwrite(&index.text_size,8,1,f) == 1 &&
+    fwrite(&n,8,1,f) == 1 && fwrite(index.offsets.data(),8,n,f) == n;
+  ok = (fclose(f) == 0) && ok;
+
+  ok = ok && rename(tmpname.c_str(), idxname) == 0;
+  if (!ok) remove(tmpname.c_str());
+  return ok;
+}
+
+
+// Gets the index for a file: from its sidecar if that's still up to date, otherwise by reading the file (and then the
+// sidecar is (re-)written). Returns false if the file can't be read.
+
+inline bool load_index(const char *filename, int format, EventIndex &index){
+
+  uint64_t size;
+  int64_t mtime;
+  if (!file_stamp(filename, size, mtime)) return false;
+
+  std::string idxname = index_file_name(filename);
+
+  if (read_index(idxname.c_str(), format, index) && index.file_size == size && index.mtime == mtime) return true;
+
+  TextInput input;
+  if (!input.open(filename)) return false;
+
+  build_index(input, format, index);
+  index.file_size = size;
+  index.mtime = mtime;
+
+  if (!write_index(idxname.c_str(), format, index))
+    std::cout << "Can't write event index " << idxname << ", it'll be rebuilt next time." << std::endl;
+
+  return true;
+}
+
+
+// Works out what to read from each file in the list:
+//   * events first_event ... first_event+n_events-1 of each file (n_events < 0 means up to the end of the file),
+//   * of which only sample_events, picked at random (with the given seed), if sample_events > 0,
+//   * split into nshards chunks of about the same number of events, which can then be converted at the same time (not for
+//     compressed files, which can only be read from the start).
+// The index of a file is only needed (and loaded, using nthreads threads) if something other than reading all of it
+// is asked for. The tasks come out in list order, and within a file in shard order. If files is only some of the files of a
+// list, numbers gives the number of each of them in the whole list, so they get the same sample as when the whole list is read.
+
+inline std::vector<FileTask> make_tasks(const std::vector<std::string> &files, int format, long first_event, long n_events,
+					long sample_events, unsigned sample_seed, int nshards, int nthreads,
+					const std::vector<int> &numbers = std::vector<int>()){
+
+  std::vector<FileTask> tasks;
+  int N = files.size();
+
+  if (nshards < 1) nshards = 1;
+
+  if (first_event <= 0 && n_events < 0 && sample_events <= 0 && nshards == 1){   // plain reading of whole files, no index needed
+    for (int i=0; i<N; i++){
+      FileTask task;
+      task.file = i;
+      task.whole_file = true;
+      tasks.push_back(task);
+    }
+    return tasks;
+  }
+
+  std::vector<EventIndex> indices(N);
+  std::vector<char> found(N);
+  run_on_files(N, nthreads, [&](int i){ found[i] = load_index(files[i].c_str(), format, indices[i]); });
+
+  for (int i=0; i<N; i++){
+
+    if (!found[i]){
+      if (text_compression(files[i].c_str()) == PLAIN_TEXT) std::cout << "Crap, no " << files[i] << " found!" << std::endl;   // otherwise TextInput has said why
+      continue;
+    }
+
+    const EventIndex &index = indices[i];
+    long total = index.nevents();
+
+    // events to read in, as event numbers:
+    long first = std::min(std::max(first_event, 0L), total);
+    long last = (n_events < 0) ? total : std::min(first + n_events, total);
+
+    std::vector<long> events;
+    if (sample_events > 0 && sample_events < last - first){
+      std::vector<long> all(last - first);
+      for (long k=0; k<last-first; k++) all[k] = first + k;
+      std::mt19937_64 rng(sample_seed + (numbers.empty() ? i : numbers[i]));
+      std::sample(all.begin(), all.end(), std::back_inserter(events), sample_events, rng);   // keeps them in file order
+    }
+    else {
+      for (long k=first; k<last; k++) events.push_back(k);
+    }
+
+    long nev = events.size();
+    int nsh = std::max(1L, std::min((long)nshards, nev));
+    if (nsh > 1 && text_compression(files[i].c_str()) != PLAIN_TEXT){
+      std::cout << files[i] << " is compressed, so it's read in one go rather than in " << nsh << " chunks." << std::endl;
+      nsh = 1;
+    }
+
+    for (int s=0; s<nsh; s++){
+      FileTask task;
+      task.file = i;
+      task.shard = s;
+
+      if (s == 0 && index.offsets[0] > 0) task.ranges.push_back({0, index.offsets[0], 0});   // header of the file
+
+      // events of this shard, with neighbouring ones merged into a single range:
+      for (long k = nev*s/nsh; k < nev*(s+1)/nsh; k++){
+	long ev = events[k];
+	if (!task.ranges.empty() && task.ranges.back().nevents > 0 && task.ranges.back().end == index.offsets[ev]){
+	  task.ranges.back().end = index.offsets[ev+1];
+	  task.ranges.back().nevents++;
+	}
+	else task.ranges.push_back({index.offsets[ev], index.offsets[ev+1], 1});
+      }
+
+      if (s == 0 && index.offsets.back() < index.text_size) task.ranges.push_back({index.offsets.back(), index.text_size, 0});   // end-of-file text
+
+      tasks.push_back(task);
+    }
+  }
+
+  return tasks;
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*****************************************************************/
+/*                                                               */
+/*   Helpers shared by the macros to read in the list of input   */
+/*   files and to convert several of them at the same time.      */
+/*                                                               */
+/*   In parallel mode each input file is converted into its own  */
+/*   temporary "part" ROOT file by whichever worker thread picks */
+/*   it up. Once all workers are done, the parts are appended to */
+/*   the output tree in the order of the list and deleted, so    */
+/*   the output doesn't depend on which thread finished first.   */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef FILE_LIST_H
+#define FILE_LIST_H
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TFile.h"
+#include "TROOT.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+
+// Reads in the list of files to process. Assumes one file name per line and no punctuation.
+// A name which is the same as the one before it is skipped, so the last file doesn't get counted twice.
+
+inline std::vector<std::string> read_file_list(const char *listname){
+
+  std::vector<std::string> files;
+
+  std::cout << "\n Reading from list: " << listname << "\n" << std::endl;
+
+  std::ifstream filelist(listname);
+
+  if (!filelist.is_open()){
+    std::cout << "Crap, no " <<  listname << " found!" << std::endl;
+    return files;
+  }
+
+  std::string file_name;
+  while (filelist >> file_name){
+    if (files.empty() || files.back() != file_name) files.push_back(file_name);
+  }
+
+  return files;
+}
+
+
+// Runs work(i) for each i = 0 ... nfiles-1 (a file in the list, or a piece of one). With nthreads > 1 that many worker
+// threads are started and each of them takes the next i as soon as it's done with its current one. nthreads = 0 uses all the cores.
+
+inline void run_on_files(int nfiles, int nthreads, std::function<void(int)> work){
+
+  if (nthreads == 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads > nfiles) nthreads = nfiles;
+
+  if (nthreads <= 1){
+    for (int i=0; i<nfiles; i++) work(i);
+    return;
+  }
+
+  ROOT::EnableThreadSafety();   // so that every thread can have its own TFile and TTree
+
+  std::atomic<int> next_file(0);
+  std::vector<std::thread> workers;
+
+  for (int t=0; t<nthreads; t++){
+    workers.emplace_back([&](){
+      for (int i = next_file++; i < nfiles; i = next_file++) work(i);
+    });
+  }
+
+  for (auto &w : workers) w.join();
+}
+
+
+// Name of the temporary ROOT file holding the converted events of file (or piece of file) number i.
+
+inline std::string part_file_name(const char *outfilename, int i){
+  return std::string(outfilename) + ".part" + std::to_string(i) + ".root";
+}
+
+
+// Whether the part file can be opened and has the tree called treename, before anything is appended from it.
+
+inline bool part_has_tree(const std::string &part, const char *treename){
+
+  TFile *partfile = TFile::Open(part.c_str(), "READ");
+  TTree *parttree = nullptr;
+  if (partfile && !partfile->IsZombie()) partfile->GetObject(treename, parttree);
+  bool found = (parttree != nullptr);
+  if (partfile) partfile->Close();
+  delete partfile;
+  return found;
+}
+
+
+// Appends the tree called treename from each of the part files to tree, in the order given, and deletes the part files.
+// The number of entries appended from each part goes in nappended, or -1 if it couldn't be (the file can't be opened, or has
+// no such tree), with a message. Returns false if any of them couldn't be, so the caller can leave out what was in it.
+
+inline bool append_parts(TTree *tree, const char *treename, const std::vector<std::string> &parts, std::vector<Long64_t> &nappended){
+
+  bool all = true;
+  nappended.assign(parts.size(), -1);
+
+  for (size_t i=0; i<parts.size(); i++){
+    const std::string &part = parts[i];
+    TFile *partfile = TFile::Open(part.c_str(), "READ");
+    if (!partfile || partfile->IsZombie()){
+      std::cout << "Crap, can't open temporary file " << part << ", its events are left out!" << std::endl;
+      delete partfile;
+      all = false;
+      continue;
+    }
+    TTree *parttree = nullptr;
+    partfile->GetObject(treename, parttree);
+    if (parttree){
+      Long64_t before = tree->GetEntries();
+      tree->CopyEntries(parttree, -1, "fast");
+      nappended[i] = tree->GetEntries() - before;
+    }
+    else {
+      std::cout << "Crap, no " << treename << " in temporary file " << part << ", its events are left out!" << std::endl;
+      all = false;
+    }
+    partfile->Close();
+    delete partfile;
+    gSystem->Unlink(part.c_str());
+  }
+
+  return all;
+}
+
+
+// Copies entries first ... first+n-1 of the tree from to the end of the tree to, which has the same branches and shares
+// their addresses (eg. it's a CloneTree(0) of it). ROOT only copies whole trees without unpacking them (CopyEntries with
+// "fast"), so that's done if the range is all of it; otherwise the entries are read back through a cache limited to the
+// range, so each cluster of it is read in and unpacked only once, and nothing outside it is. Returns the number of entries
+// copied.
+
+inline Long64_t copy_entry_range(TTree *from, TTree *to, Long64_t first, Long64_t n){
+
+  if (n <= 0) return 0;
+  if (first == 0 && n == from->GetEntries()){
+    Long64_t before = to->GetEntries();
+    to->CopyEntries(from, -1, "fast");
+    return to->GetEntries() - before;
+  }
+
+  from->SetCacheSize(1<<26);          // 64 MB
+  from->AddBranchToCache("*", true);
+  from->SetCacheEntryRange(first, first + n);
+
+  for (Long64_t i=first; i<first+n; i++){
+    from->GetEntry(i);
+    to->Fill();
+  }
+  return n;
+}
+
+#endif
@@ -0,0 +1,184 @@
+/*****************************************************************/
+/*                                                               */
+/*   Record of the input files converted into an output file,    */
+/*   saved in it as a tree with an entry per file (TCSfiles in   */
+/*   parse_hepmc.C): the path of the file, its size and          */
+/*   modification time (and a hash of its contents if asked      */
+/*   for), where its events are in the event tree, and what was  */
+/*   found in it -- helicity, cross-section and its uncertainty. */
+/*                                                               */
+/*   With append_mode, the records of an earlier output file are */
+/*   read back in so that only the files of the list which       */
+/*   aren't in it yet, or have changed since, get converted and  */
+/*   added to it. The totals (eg. the integrated cross-section)  */
+/*   are then worked out again from the records, so no file is   */
+/*   ever counted twice.                                         */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef FILE_RECORDS_H
+#define FILE_RECORDS_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "TFile.h"
+#include "TObject.h"
+#include "TTree.h"
+#include "event_index.h"
+#include "line_reader.h"
+
+
+struct FileRecord {
+  std::string path;          // full path of the file
+  Long64_t size = 0;         // in bytes
+  Long64_t mtime = 0;        // modification time, in ns
+  ULong64_t hash = 0;        // of the contents of the file (see file_hash), 0 if it hasn't been worked out
+  Long64_t first_entry = 0;  // entry of the event tree its events start at
+  Long64_t nevents = 0;      // number of its events in the event tree
+  int helicity = 0;          // electron helicity
+  double xsec = 0.;          // integrated cross-section quoted in the file, and its uncertainty
+  double xsec_err = 0.;
+  std::string events;        // which of its events were read in (first_event, n_events...)
+  std::string layout;        // how they were written out (schema, float_leaves...)
+};
+
+
+// Full path of a file, or the name as it is if the file can't be found.
+
+inline std::string full_file_name(const std::string &name){
+  char *full = realpath(name.c_str(), nullptr);
+  if (!full) return name;
+  std::string path = full;
+  free(full);
+  return path;
+}
+
+
+// Hash of the contents of a file, to tell whether it has changed when its modification time has. It only has to tell files
+// apart, so it's a quick one (8 bytes at a time), not a cryptographic one. Returns 0 if the file can't be read.
+
+inline uint64_t file_hash(const char *filename){
+
+  MappedFile file;
+  if (!file.open(filename)) return 0;
+
+  uint64_t h = 0xcbf29ce484222325ULL ^ file.size;
+  size_t n8 = file.size/8;
+  for (size_t k=0; k<n8; k++){
+    uint64_t word;
+    memcpy(&word, file.data + 8*k, 8);
+    h = (h ^ word)*0x100000001b3ULL;
+    h ^= h >> 29;
+  }
+  for (size_t k=8*n8; k<file.size; k++) h = (h ^ (unsigned char)file.data[k])*0x100000001b3ULL;
+
+  file.close();
+  return h ? h : 1;   // 0 is for "not worked out"
+}
+
+
+// Record of a file as it is now, before it's converted: the path, size and modification time. Returns false if the file
+// isn't there.
+
+inline bool stamp_record(const std::string &name, FileRecord &record){
+  uint64_t size;
+  int64_t mtime;
+  if (!file_stamp(name.c_str(), size, mtime)) return false;
+  record.path = full_file_name(name);
+  record.size = size;
+  record.mtime = mtime;
+  return true;
+}
+
+
+// Whether a file is still the same as when its record was made. By default it has changed if its size or modification time has;
+// with by_hash, a file whose size is the same but whose modification time isn't (eg. it's been copied over again) is only taken
+// to have changed if the hash of its contents has too -- and then its hash is worked out and kept in now.
+
+inline bool same_file(const FileRecord &earlier, FileRecord &now, bool by_hash){
+  if (now.size != earlier.size) return false;
+  if (now.mtime == earlier.mtime) return true;
+  if (!by_hash || earlier.hash == 0) return false;
+  if (now.hash == 0) now.hash = file_hash(now.path.c_str());
+  return now.hash == earlier.hash;
+}
+
+
+// Number of the record of the file with the given full path, -1 if there's none.
+
+inline int find_record(const std::vector<FileRecord> &records, const std::string &path){
+  for (size_t r=0; r<records.size(); r++) if (records[r].path == path) return r;
+  return -1;
+}
+
+
+// Reads the records saved in a file as the tree treename. Returns false if there's no such tree.
+
+inline bool read_file_records(TFile *file, const char *treename, std::vector<FileRecord> &records){
+
+  TTree *tree = nullptr;
+  file->GetObject(treename, tree);
+  if (!tree) return false;
+
+  FileRecord rec;
+  std::string *path = nullptr, *events = nullptr, *layout = nullptr;
+  tree->SetBranchAddress("path", &path);
+  tree->SetBranchAddress("size", &rec.size);
+  tree->SetBranchAddress("mtime", &rec.mtime);
+  tree->SetBranchAddress("hash", &rec.hash);
+  tree->SetBranchAddress("first_entry", &rec.first_entry);
+  tree->SetBranchAddress("nevents", &rec.nevents);
+  tree->SetBranchAddress("helicity", &rec.helicity);
+  tree->SetBranchAddress("xsec", &rec.xsec);
+  tree->SetBranchAddress("xsec_err", &rec.xsec_err);
+  tree->SetBranchAddress("events", &events);
+  tree->SetBranchAddress("layout", &layout);
+
+  records.clear();
+  for (Long64_t i=0; i<tree->GetEntries(); i++){
+    tree->GetEntry(i);
+    rec.path = *path;
+    rec.events = *events;
+    rec.layout = *layout;
+    records.push_back(rec);
+  }
+
+  tree->ResetBranchAddresses();
+  delete path;
+  delete events;
+  delete layout;
+  return true;
+}
+
+
+// Saves the records in the current directory as the tree treename, in place of the one there if there's one already.
+
+inline void write_file_records(const char *treename, const std::vector<FileRecord> &records){
+
+  TTree *tree = new TTree(treename, "Input files converted into this file");
+
+  FileRecord rec;
+  tree->Branch("path", &rec.path);
+  tree->Branch("size", &rec.size, "size/L");
+  tree->Branch("mtime", &rec.mtime, "mtime/L");
+  tree->Branch("hash", &rec.hash, "hash/l");
+  tree->Branch("first_entry", &rec.first_entry, "first_entry/L");
+  tree->Branch("nevents", &rec.nevents, "nevents/L");
+  tree->Branch("helicity", &rec.helicity, "helicity/I");
+  tree->Branch("xsec", &rec.xsec, "xsec/D");
+  tree->Branch("xsec_err", &rec.xsec_err, "xsec_err/D");
+  tree->Branch("events", &rec.events);
+  tree->Branch("layout", &rec.layout);
+
+  for (const auto &r : records){
+    rec = r;
+    tree->Fill();
+  }
+
+  tree->Write("", TObject::kOverwrite);
+}
+
+#endif
@@ -0,0 +1,193 @@
+/*****************************************************************/
+/*                                                               */
+/*   Kinematic quantities computed by the converters and saved   */
+/*   as extra branches of the event trees, so analyses don't     */
+/*   have to work them out again from the four-momenta:          */
+/*                                                               */
+/*     Q2       -(ebeam - escattered)^2                          */
+/*     t        (pbeam - recoil)^2                               */
+/*     Mll      mass of lep_minus + lep_plus                     */
+/*     theta_l  polar and azimuthal angles of lep_minus in the   */
+/*     phi_l    rest frame of the lepton pair (see below)        */
+/*     Mgg      mass of photon1 + photon2 (pi0 from GenEvent)    */
+/*                                                               */
+/*   Masses are signed like TLorentzVector::M(): -sqrt(-m^2) if  */
+/*   m^2 < 0.                                                    */
+/*                                                               */
+/*   Lepton angles (as in Berger, Diehl, Pire, EPJ C23 (2002)    */
+/*   675): in the lepton pair rest frame, z is opposite to the   */
+/*   recoil, y is along q x recoil (normal to the hadronic       */
+/*   plane), x = y x z. theta_l is the angle between lep_minus   */
+/*   and z, phi_l = atan2(lep_minus.y, lep_minus.x).             */
+/*                                                               */
+/*   The events are handled in batches: the four-momenta of      */
+/*   KINEMATICS_BATCH events are stored as one array per         */
+/*   component (FourVectors), and each quantity is worked out    */
+/*   for the whole batch in a plain loop over these arrays,      */
+/*   which the compiler can vectorise. The *_reference functions */
+/*   do the same per event with TLorentzVector, and are what the */
+/*   batched results are checked against: they agree to within   */
+/*   KINEMATICS_TOLERANCE, relative for the masses, Q2 and t     */
+/*   (absolute below 1 GeV^2), absolute in rad for the angles.   */
+/*   See bench_kinematics.C.                                     */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include <cmath>
+#include <vector>
+#include "TLorentzVector.h"
+#include "TVector3.h"
+
+enum { KINEMATICS_BATCH = 1024 };   // number of events computed in one go
+
+const double KINEMATICS_TOLERANCE = 1e-9;
+
+
+// Four-momenta of the events of a batch, one array per component.
+
+struct FourVectors {
+  std::vector<double> px, py, pz, E;
+
+  void resize(int n){
+    px.resize(n);
+    py.resize(n);
+    pz.resize(n);
+    E.resize(n);
+  }
+
+  void set(int i, const TLorentzVector &v){
+    px[i] = v.Px();
+    py[i] = v.Py();
+    pz[i] = v.Pz();
+    E[i] = v.E();
+  }
+
+  void get(int i, TLorentzVector &v) const { v.SetPxPyPzE(px[i], py[i], pz[i], E[i]); }
+};
+
+
+// Batched kernels, for events 0 ... n-1 of the batch:
+
+// m2[i] = sign * (a + sign_b*b)^2, ie. the invariant mass squared of a+b (sign_b = 1) or a-b (sign_b = -1)
+inline void batch_mass2(int n, const FourVectors &a, const FourVectors &b, double sign_b, double sign, double *m2){
+  const double *apx = a.px.data(), *apy = a.py.data(), *apz = a.pz.data(), *aE = a.E.data();
+  const double *bpx = b.px.data(), *bpy = b.py.data(), *bpz = b.pz.data(), *bE = b.E.data();
+  for (int i=0; i<n; i++){
+    double x = apx[i] + sign_b*bpx[i];
+    double y = apy[i] + sign_b*bpy[i];
+    double z = apz[i] + sign_b*bpz[i];
+    double e = aE[i] + sign_b*bE[i];
+    m2[i] = sign*(e*e - x*x - y*y - z*z);
+  }
+}
+
+// mass of a+b, signed like TLorentzVector::M()
+inline void batch_mass(int n, const FourVectors &a, const FourVectors &b, double *m){
+  batch_mass2(n, a, b, 1., 1., m);
+  for (int i=0; i<n; i++) m[i] = std::copysign(std::sqrt(std::fabs(m[i])), m[i]);
+}
+
+// Q2 = -(ebeam - escattered)^2
+inline void batch_Q2(int n, const FourVectors &ebeam, const FourVectors &escattered, double *Q2){
+  batch_mass2(n, ebeam, escattered, -1., -1., Q2);
+}
+
+// t = (pbeam - recoil)^2
+inline void batch_t(int n, const FourVectors &pbeam, const FourVectors &recoil, double *t){
+  batch_mass2(n, pbeam, recoil, -1., 1., t);
+}
+
+// Angles of lep_minus in the lepton pair rest frame, see the top of the file. cos_theta and the x and y components of lep_minus
+// are worked out in the vectorised loop, the acos and atan2 in a second one. scratch has room for n numbers (the y components),
+// and is kept by the caller from one batch to the next so nothing is allocated here.
+inline void batch_lepton_angles(int n, const FourVectors &q, const FourVectors &recoil, const FourVectors &lep_minus,
+				const FourVectors &lep_plus, double *theta, double *phi, double *scratch){
+
+  double *cos_theta = theta, *lx = phi, *ly = scratch;
+  const double *qpx = q.px.data(), *qpy = q.py.data(), *qpz = q.pz.data(), *qE = q.E.data();
+  const double *rpx = recoil.px.data(), *rpy = recoil.py.data(), *rpz = recoil.pz.data(), *rE = recoil.E.data();
+  const double *mpx = lep_minus.px.data(), *mpy = lep_minus.py.data(), *mpz = lep_minus.pz.data(), *mE = lep_minus.E.data();
+  const double *ppx = lep_plus.px.data(), *ppy = lep_plus.py.data(), *ppz = lep_plus.pz.data(), *pE = lep_plus.E.data();
+
+  // The outputs don't overlap the 16 inputs, but that's too many run-time overlap checks for the compiler, so it has to be told:
+#if defined(__clang__)
+#pragma clang loop vectorize(assume_safety)
+#elif defined(__GNUC__)
+#pragma GCC ivdep
+#endif
+  for (int i=0; i<n; i++){
+
+    // velocity of the pair, and the boost taking it to rest:
+    double Epair = mE[i] + pE[i];
+    double bx = (mpx[i] + ppx[i])/Epair;
+    double by = (mpy[i] + ppy[i])/Epair;
+    double bz = (mpz[i] + ppz[i])/Epair;
+    double b2 = bx*bx + by*by + bz*bz;
+    double gamma = 1./std::sqrt(1. - b2);
+    double gamma2 = gamma*gamma/(gamma + 1.);   // (gamma - 1)/b2, without dividing by 0 for a pair at rest
+
+    // three-momenta in the pair rest frame: p + gamma2*(b.p)*b - gamma*E*b
+    double bp, f;
+
+    bp = bx*qpx[i] + by*qpy[i] + bz*qpz[i];
+    f = gamma2*bp - gamma*qE[i];
+    double qx = qpx[i] + f*bx, qy = qpy[i] + f*by, qz = qpz[i] + f*bz;
+
+    bp = bx*rpx[i] + by*rpy[i] + bz*rpz[i];
+    f = gamma2*bp - gamma*rE[i];
+    double rx = rpx[i] + f*bx, ry = rpy[i] + f*by, rz = rpz[i] + f*bz;
+
+    bp = bx*mpx[i] + by*mpy[i] + bz*mpz[i];
+    f = gamma2*bp - gamma*mE[i];
+    double mx = mpx[i] + f*bx, my = mpy[i] + f*by, mz = mpz[i] + f*bz;
+
+    // axes: z = -recoil, y = q x recoil, x = y x z, all unit vectors
+    double rmag = std::sqrt(rx*rx + ry*ry + rz*rz);
+    double zx = -rx/rmag, zy = -ry/rmag, zz = -rz/rmag;
+    double yx = qy*rz - qz*ry, yy = qz*rx - qx*rz, yz = qx*ry - qy*rx;
+    double ymag = std::sqrt(yx*yx + yy*yy + yz*yz);
+    yx /= ymag; yy /= ymag; yz /= ymag;
+    double xx = yy*zz - yz*zy, xy = yz*zx - yx*zz, xz = yx*zy - yy*zx;
+
+    double mmag = std::sqrt(mx*mx + my*my + mz*mz);
+    double c = (mx*zx + my*zy + mz*zz)/mmag;
+    cos_theta[i] = c > 1. ? 1. : (c < -1. ? -1. : c);   // rounding can take it just past 1
+    lx[i] = mx*xx + my*xy + mz*xz;
+    ly[i] = mx*yx + my*yy + mz*yz;
+  }
+
+  for (int i=0; i<n; i++){
+    theta[i] = std::acos(cos_theta[i]);
+    phi[i] = std::atan2(ly[i], lx[i]);
+  }
+}
+
+
+// The same per event, with TLorentzVector:
+
+inline double Q2_reference(const TLorentzVector &ebeam, const TLorentzVector &escattered){ return -(ebeam - escattered).M2(); }
+
+inline double t_reference(const TLorentzVector &pbeam, const TLorentzVector &recoil){ return (pbeam - recoil).M2(); }
+
+inline double mass_reference(const TLorentzVector &a, const TLorentzVector &b){ return (a + b).M(); }
+
+inline void lepton_angles_reference(const TLorentzVector &q, const TLorentzVector &recoil, const TLorentzVector &lep_minus,
+				    const TLorentzVector &lep_plus, double &theta, double &phi){
+  TVector3 boost = -(lep_minus + lep_plus).BoostVector();
+  TLorentzVector q_rest = q, recoil_rest = recoil, lep_rest = lep_minus;
+  q_rest.Boost(boost);
+  recoil_rest.Boost(boost);
+  lep_rest.Boost(boost);
+
+  TVector3 z = -recoil_rest.Vect().Unit();
+  TVector3 y = q_rest.Vect().Cross(recoil_rest.Vect()).Unit();
+  TVector3 x = y.Cross(z);
+
+  theta = lep_rest.Vect().Angle(z);
+  phi = std::atan2(lep_rest.Vect().Dot(y), lep_rest.Vect().Dot(x));
+}
+
+#endif
@@ -0,0 +1,153 @@
+/*****************************************************************/
+/*                                                               */
+/*   Helpers shared by the macros to read generator text files   */
+/*   quickly: the whole file is memory-mapped, split into lines  */
+/*   without copying, and the numbers on each line are parsed    */
+/*   straight from the mapped bytes with std::from_chars, which  */
+/*   (unlike ifstream >>) does no locale or stream-state work.   */
+/*                                                               */
+/*   Usage, from a macro:                                        */
+/*     #include "line_reader.h"                                  */
+/*                                                               */
+/*     MappedFile file;                                          */
+/*     if (file.open(filename)){                                 */
+/*       LineReader lines(file.data, file.size);                 */
+/*       const char *b, *e;                                      */
+/*       while (lines.next(b,e)){ ... read_int(b,e,i) ... }      */
+/*     }                                                         */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Read-only memory map of a whole file. The mapping is released by close() or when the object goes out of scope.
+
+struct MappedFile {
+  const char *data = nullptr;
+  size_t size = 0;
+  int fd = -1;
+
+  bool open(const char *filename){
+    close();
+    fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0){
+      close();
+      return false;
+    }
+    size = st.st_size;
+    if (size == 0) return true;   // nothing to map, but not an error: the file just has no lines
+    void *m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED){
+      close();
+      return false;
+    }
+    madvise(m, size, MADV_SEQUENTIAL);   // we only ever walk forward through the file
+    data = (const char*)m;
+    return true;
+  }
+
+  void close(){
+    if (data) munmap((void*)data, size);
+    if (fd >= 0) ::close(fd);
+    data = nullptr;
+    size = 0;
+    fd = -1;
+  }
+
+  ~MappedFile(){ close(); }
+};
+
+
+// Splits a block of text into lines. [b,e) is set to each line in turn, without the trailing "\n" (or "\r\n").
+
+struct LineReader {
+  const char *pos;
+  const char *end;
+
+  LineReader(const char *data, size_t size) : pos(data), end(data + size) {}
+
+  bool next(const char *&b, const char *&e){
+    if (pos >= end) return false;
+    b = pos;
+    const char *nl = (const char*)memchr(pos, '\n', end - pos);
+    if (nl){
+      e = nl;
+      pos = nl + 1;
+    }
+    else {   // last line without a newline at the end
+      e = end;
+      pos = end;
+    }
+    if (e > b && *(e-1) == '\r') e--;
+    return true;
+  }
+};
+
+
+// Token helpers. Each one skips leading blanks, reads one token starting at p and moves p past it.
+// They return false (and leave the value untouched) if there's no valid token left on the line.
+
+inline const char* skip_blanks(const char *p, const char *e){
+  while (p < e && (*p == ' ' || *p == '\t')) p++;
+  return p;
+}
+
+inline bool next_token(const char *&p, const char *e, const char *&tb, const char *&te){
+  p = skip_blanks(p, e);
+  if (p == e) return false;
+  tb = p;
+  while (p < e && *p != ' ' && *p != '\t') p++;
+  te = p;
+  return true;
+}
+
+inline bool read_int(const char *&p, const char *e, int &value){
+  p = skip_blanks(p, e);
+  if (p < e && *p == '+') p++;
+  std::from_chars_result r = std::from_chars(p, e, value);
+  if (r.ec != std::errc()) return false;
+  p = r.ptr;
+  return true;
+}
+
+inline bool read_double(const char *&p, const char *e, double &value){
+  p = skip_blanks(p, e);
+  if (p < e && *p == '+') p++;
+#if defined(__cpp_lib_to_chars) || (defined(__GNUC__) && __GNUC__ >= 11)
+  std::from_chars_result r = std::from_chars(p, e, value);
+  if (r.ec != std::errc()) return false;
+  p = r.ptr;
+#else
+  // older standard libraries have no floating-point from_chars: fall back to strtod on a copy of the token
+  char buf[64];
+  const char *tb, *te;
+  const char *q = p;
+  if (!next_token(q, e, tb, te) || te - tb >= (long)sizeof(buf)) return false;
+  memcpy(buf, tb, te - tb);
+  buf[te - tb] = 0;
+  char *stop;
+  value = strtod(buf, &stop);
+  if (stop == buf) return false;
+  p = tb + (stop - buf);
+#endif
+  return true;
+}
+
+inline bool token_is(const char *tb, const char *te, const char *word){
+  size_t n = strlen(word);
+  return (size_t)(te - tb) == n && memcmp(tb, word, n) == 0;
+}
+
+#endif
@@ -0,0 +1,183 @@
+/*****************************************************************/
+/*                                                               */
+/*   Reader for LUND files, shared by the LUND macros. The file  */
+/*   is memory-mapped (or decompressed on the fly if it's        */
+/*   compressed, see compressed_io.h) and read one event at a    */
+/*   time into a LundEvent: the header line and however many     */
+/*   particle lines follow it. The particle list of the event is */
+/*   re-used from one event to the next, so once it has grown to */
+/*   the largest event in the file nothing more is allocated.    */
+/*                                                               */
+/*   Header line:   number of particles, A, Z, target and beam   */
+/*                  polarisation, beam type, beam energy, target */
+/*                  particle, process, cross-section -- read     */
+/*                  into ivar[0..5] dvar[0] ivar[6] ivar[7]      */
+/*                  dvar[1], the way the macros always have.     */
+/*   Particle line: ipar[0..5] dpar[0..7], ie. index, lifetime,  */
+/*                  type, pid, parent, daughter, then px, py,    */
+/*                  pz, E, mass, vx, vy, vz.                     */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef LUND_READER_H
+#define LUND_READER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "event_index.h"
+#include "line_reader.h"
+#include "run_stats.h"
+
+
+struct LundParticle {
+  int ipar[6];      // int in particle line
+  double dpar[8];   // double in particle line
+
+  int index() const { return ipar[0]; }
+  int pid() const { return ipar[3]; }
+};
+
+
+struct LundEvent {
+  int ivar[10] = {};         // int in header line
+  double dvar[10] = {};      // double in header line
+  std::vector<LundParticle> particles;
+
+  long number = 0;           // number of the event in the part of the file being read, counting from 0
+  int bad = 0;               // set by the OddBallCheck stage if the event doesn't look like what's expected
+
+  int npart() const { return ivar[0]; }
+  int target() const { return ivar[6]; }
+
+  // the particle with the given index (1 is the first one in the event), or nullptr if there's none
+  const LundParticle* find(int index) const {
+    for (const auto &part : particles) if (part.ipar[0] == index) return &part;
+    return nullptr;
+  }
+
+  // pid of the active nucleon, ie. the particle with index 3 if it's the specified target particle, 0 otherwise
+  int active_pid() const {
+    const LundParticle *part = find(3);
+    return (part && part->ipar[3] == ivar[6]) ? part->ipar[3] : 0;
+  }
+};
+
+
+// Reads the events from a file, or from the ranges of it given by a FileTask (see event_index.h).
+
+struct LundReader {
+  const char *filename;
+  TextInput input;
+  std::vector<EventRange> ranges;
+  size_t next_range = 0;
+  long nread = 0;        // events read in so far
+  long nmalformed = 0;   // events skipped because their particle lines don't match the header, or it gives no sensible number of them
+  bool held = false;     // a line read in ahead, to be handed out again by next_line
+  const char *held_b = nullptr, *held_e = nullptr;
+  StageClock clock;      // with clock.on, the time spent getting the lines and tokenizing them (see run_stats.h)
+
+  LundReader(const char *name) : filename(name) {}
+
+  bool open(const FileTask &task){
+    if (!input.open(filename)) return false;
+    if (task.whole_file) ranges.assign(1, EventRange{0, TEXT_END, -1});
+    else ranges = task.ranges;
+    next_range = 0;
+    held = false;
+    return true;
+  }
+
+  // next non-blank line of the ranges still to read
+  bool next_line(const char *&b, const char *&e){
+    if (held){
+      held = false;
+      b = held_b;
+      e = held_e;
+      return true;
+    }
+    while (true){
+      while (input.next(b,e)){
+	if (skip_blanks(b,e) == e) continue;
+	clock.lap(STAGE_READ);
+	return true;
+      }
+      while (next_range < ranges.size() && ranges[next_range].nevents == 0) next_range++;   // header/end-of-file text: nothing in LUND files
+      if (next_range == ranges.size()) return false;
+      const EventRange &range = ranges[next_range++];
+      if (!input.start_range(range.begin, range.end)){
+	std::cout << "Event index of " << filename << " doesn't match the file, delete " << index_file_name(filename) << "!" << std::endl;
+	return false;
+      }
+    }
+  }
+
+  static bool read_particle(const char *p, const char *e, LundParticle &part){
+    int *ip = part.ipar;
+    double *dp = part.dpar;
+    return read_int(p,e,ip[0]) && read_int(p,e,ip[1]) && read_int(p,e,ip[2]) && read_int(p,e,ip[3]) && read_int(p,e,ip[4]) && read_int(p,e,ip[5]) &&
+      read_double(p,e,dp[0]) && read_double(p,e,dp[1]) && read_double(p,e,dp[2]) && read_double(p,e,dp[3]) &&
+      read_double(p,e,dp[4]) && read_double(p,e,dp[5]) && read_double(p,e,dp[6]) && read_double(p,e,dp[7]);
+  }
+
+  // Reads the next event into ev. Returns false at the end, or if a line can't be read (the rest of the file is then skipped,
+  // as there's no telling where the next event starts).
+  bool next(LundEvent &ev){
+
+    const char *b, *e;
+
+    while (next_line(b,e)){
+
+      const char *p = b;
+      int *iv = ev.ivar;
+      double *dv = ev.dvar;
+      if (!(read_int(p,e,iv[0]) && read_int(p,e,iv[1]) && read_int(p,e,iv[2]) && read_int(p,e,iv[3]) && read_int(p,e,iv[4]) &&
+	    read_int(p,e,iv[5]) && read_double(p,e,dv[0]) && read_int(p,e,iv[6]) && read_int(p,e,iv[7]) && read_double(p,e,dv[1]))){
+	std::cout << "Can't read LUND header line in " << filename << ": " << std::string(b,e) << std::endl;
+	return false;
+      }
+      clock.lap(STAGE_TOKENIZE);
+
+      // a number of particles that can't be right: the particle lines after it (if any) are skipped, up to the next line
+      // that isn't one, which is taken to be the next header
+      if (iv[0] < 0 || iv[0] > LUND_MAX_PARTICLES){
+	nmalformed++;
+	LundParticle part;
+	while (next_line(b,e)){
+	  if (read_particle(b,e,part)) continue;
+	  held = true;
+	  held_b = b;
+	  held_e = e;
+	  break;
+	}
+	continue;
+      }
+
+      ev.particles.resize(iv[0]);
+      for (auto &part : ev.particles){
+	if (!next_line(b,e)) return false;   // file ends in the middle of an event
+	if (!read_particle(b,e,part)){
+	  std::cout << "Can't read LUND particle line in " << filename << ": " << std::string(b,e) << std::endl;
+	  return false;
+	}
+	clock.lap(STAGE_TOKENIZE);
+      }
+
+      if (iv[0] == 0) continue;   // header without particles
+
+      // the last particle is numbered with the number of particles in the event, otherwise something's off:
+      if (ev.particles.back().ipar[0] != iv[0]){
+	nmalformed++;
+	continue;
+      }
+
+      ev.number = nread++;
+      ev.bad = 0;
+      return true;
+    }
+
+    return false;
+  }
+};
+
+#endif
@@ -0,0 +1,250 @@
+/*****************************************************************/
+/*                                                               */
+/*   Writes LUND events out to several sets of files in one      */
+/*   pass, each set chosen by its own routing rule (active       */
+/*   nucleon, target, number of particles, a kinematic cut...).  */
+/*   An event goes to every set whose rule it passes.            */
+/*                                                               */
+/*   The output files of each set stay open while an input file  */
+/*   is read, and are written through a large buffer, compressed */
+/*   with gzip, zstd or xz if asked for. Events are formatted by */
+/*   hand rather than with iostream manipulators, but the text   */
+/*   is the same, byte for byte, as what std::fixed with         */
+/*   setprecision(6) (header) and setprecision(8) (particles)    */
+/*   used to give.                                               */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef LUND_ROUTER_H
+#define LUND_ROUTER_H
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "compressed_io.h"
+#include "lund_reader.h"
+
+
+// A file written through a buffer of its own, flushed when it's full and when the file is closed. With a compression
+// other than PLAIN_TEXT (see compressed_io.h), what's in the buffer is compressed on its way to the file.
+
+struct BufferedWriter {
+  int fd = -1;
+  std::vector<char> buf;
+  size_t used = 0;
+  TextCompressor compressor;
+
+  bool open(const char *filename, size_t bufsize = 1<<20, int compression = PLAIN_TEXT, int level = -1){
+    close();
+    fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);   // re-created, so events don't get added to the end of an old file
+    buf.resize(bufsize);
+    used = 0;
+    if (fd >= 0 && compression != PLAIN_TEXT && !compressor.begin(compression, level)){
+      std::cout << "Crap, can't compress " << filename << " with " << compression_name(compression) << "!" << std::endl;
+      close();
+    }
+    return fd >= 0;
+  }
+
+  void write_all(const char *data, size_t n){
+    while (fd >= 0 && n > 0){
+      ssize_t done = ::write(fd, data, n);
+      if (done <= 0){
+	std::cout << "Crap, can't write output file!" << std::endl;
+	break;
+      }
+      data += done;
+      n -= done;
+    }
+  }
+
+  // writes n bytes out, compressed if the file is (finish ends the compressed stream)
+  void put(const char *data, size_t n, bool finish = false){
+    if (compressor.format == PLAIN_TEXT) write_all(data, n);
+    else if (!compressor.compress(data, n, finish, [this](const char *d, size_t m){ write_all(d, m); }))
+      std::cout << "Crap, can't compress output file! " << compressor.error << std::endl;
+  }
+
+  void flush(bool finish = false){
+    put(buf.data(), used, finish);
+    used = 0;
+  }
+
+  void write(const char *data, size_t n){
+    if (used + n > buf.size()) flush();
+    if (n > buf.size()) put(data, n);   // bigger than the whole buffer, no point copying it in
+    else {
+      memcpy(buf.data() + used, data, n);
+      used += n;
+    }
+  }
+
+  void close(){
+    if (fd < 0) return;
+    flush(true);
+    compressor.end();
+    ::close(fd);
+    fd = -1;
+  }
+
+  ~BufferedWriter(){ close(); }
+};
+
+
+// Number formatting, appended to the end of out. Doubles are written like printf("%.*f"), which is what std::fixed does.
+
+inline void append_int(std::string &out, int value){
+  char tmp[16];
+  std::to_chars_result r = std::to_chars(tmp, tmp+sizeof(tmp), value);
+  out.append(tmp, r.ptr - tmp);
+}
+
+inline void append_fixed(std::string &out, double value, int precision){
+  char tmp[512];   // big enough for any double with up to 8 decimals
+#if defined(__cpp_lib_to_chars) || (defined(__GNUC__) && __GNUC__ >= 11)
+  std::to_chars_result r = std::to_chars(tmp, tmp+sizeof(tmp), value, std::chars_format::fixed, precision);
+  out.append(tmp, r.ptr - tmp);
+#else
+  out.append(tmp, snprintf(tmp, sizeof(tmp), "%.*f", precision, value));
+#endif
+}
+
+
+// The text of an event, in the same layout split_lundfile has always written it.
+
+inline void format_lund_event(const LundEvent &ev, std::string &out){
+
+  const int *iv = ev.ivar;
+  const double *dv = ev.dvar;
+
+  append_int(out,iv[0]); out += ' '; append_int(out,iv[1]); out += ' '; append_int(out,iv[2]); out += ' ';
+  append_int(out,iv[3]); out += ' '; append_int(out,iv[4]); out += ' '; append_int(out,iv[5]); out += ' ';
+  append_fixed(out,dv[0],6); out += ' '; append_int(out,iv[6]); out += ' '; append_int(out,iv[7]); out += ' ';
+  append_fixed(out,dv[1],6); out += '\n';
+
+  for (const auto &part : ev.particles){
+    const int *ip = part.ipar;
+    const double *dp = part.dpar;
+    append_int(out,ip[0]); out += ' '; append_int(out,ip[1]); out += ' '; append_int(out,ip[2]); out += ' ';
+    append_int(out,ip[3]); out += ' '; append_int(out,ip[4]); out += "  "; append_int(out,ip[5]); out += "   ";
+    append_fixed(out,dp[0],8); out += "    "; append_fixed(out,dp[1],8); out += "    "; append_fixed(out,dp[2],8); out += "    ";
+    append_fixed(out,dp[3],8); out += "    "; append_fixed(out,dp[4],8); out += "   "; append_fixed(out,dp[5],8); out += "   ";
+    append_fixed(out,dp[6],8); out += "   "; append_fixed(out,dp[7],8); out += '\n';
+  }
+}
+
+
+// Routing rules, to be passed to LundRouter::add:
+
+typedef std::function<bool(const LundEvent&)> LundRule;
+
+inline LundRule active_nucleon(int pid){ return [pid](const LundEvent &ev){ return ev.active_pid() == pid; }; }   // eg. 2212 for the proton
+inline LundRule target_is(int pid){ return [pid](const LundEvent &ev){ return ev.target() == pid; }; }
+inline LundRule particle_count(int n){ return [n](const LundEvent &ev){ return ev.npart() == n; }; }
+
+
+// Name of the output file of a set for input file number N: <name>_N.dat, with .gz, .zst or .xz added if it's compressed.
+// If the input file is read in several chunks at the same time (see nshards), chunk s > 0 first goes to <name>_N.dat.part<s>,
+// and join_chunks adds it to the end of <name>_N.dat.
+
+inline std::string route_file_name(const std::string &name, int N, int chunk = 0, int compression = PLAIN_TEXT){
+  std::string fullname = name + "_" + std::to_string(N) + ".dat" + compression_suffix(compression);
+  if (chunk > 0) fullname += ".part" + std::to_string(chunk);
+  return fullname;
+}
+
+
+// Appends chunks 1 ... nchunks-1 of a set of files for input file number N to chunk 0, in order, and deletes them.
+// Compressed chunks are added as they are: gzip, zstd and xz all read a file made of several compressed streams one after
+// the other as the text of each stream in turn.
+
+inline void join_chunks(const std::string &name, int N, int nchunks, int compression = PLAIN_TEXT){
+
+  if (nchunks < 2) return;
+
+  std::string fullname = route_file_name(name, N, 0, compression);
+  BufferedWriter out;
+  out.fd = ::open(fullname.c_str(), O_WRONLY | O_APPEND);
+  if (out.fd < 0){
+    std::cout << "Crap, can't open " << fullname << " to add the other chunks to it!" << std::endl;
+    return;
+  }
+  out.buf.resize(1<<20);
+
+  for (int s=1; s<nchunks; s++){
+    std::string partname = route_file_name(name, N, s, compression);
+    MappedFile part;
+    if (part.open(partname.c_str())) out.write(part.data, part.size);
+    else std::cout << "Crap, no " << partname << " found!" << std::endl;
+    part.close();
+    remove(partname.c_str());
+  }
+}
+
+
+// A set of output files and the rule for which events go in it.
+
+struct LundRoute {
+  std::string name;
+  LundRule rule;
+  BufferedWriter out;
+  long nfile = 0;    // events written since the files were last opened
+};
+
+
+struct LundRouter {
+  std::vector<LundRoute*> routes;
+  std::string text;              // the current event, formatted once for all the routes it goes to
+  int compression = PLAIN_TEXT;  // of the output files, see compressed_io.h
+  int level = -1;                // compression level, -1 for the usual one
+
+  LundRouter() = default;
+  LundRouter(const LundRouter&) = delete;              // it owns the routes, and their open files: a copy would delete
+  LundRouter& operator=(const LundRouter&) = delete;   // them a second time
+
+  void add(const char *name, LundRule rule){
+    LundRoute *r = new LundRoute;
+    r->name = name;
+    r->rule = rule;
+    routes.push_back(r);
+  }
+
+  // (re-)creates the output files for input file number N, or chunk number "chunk" of it
+  void open_files(int N, int chunk = 0){
+    for (auto r : routes){
+      std::string fullname = route_file_name(r->name, N, chunk, compression);
+      if (!r->out.open(fullname.c_str(), 1<<20, compression, level)) std::cout << "Crap, can't create " << fullname << "!" << std::endl;
+      r->nfile = 0;
+    }
+  }
+
+  // writes the event to every set of files whose rule it passes, returns how many that is
+  int route(const LundEvent &ev){
+    int nroutes = 0;
+    text.clear();
+    for (auto r : routes){
+      if (!r->rule(ev)) continue;
+      if (text.empty()) format_lund_event(ev, text);
+      r->out.write(text.data(), text.size());
+      r->nfile++;
+      nroutes++;
+    }
+    return nroutes;
+  }
+
+  void close_files(){
+    for (auto r : routes) r->out.close();
+  }
+
+  ~LundRouter(){
+    for (auto r : routes) delete r;
+  }
+};
+
+#endif
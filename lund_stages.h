@@ -0,0 +1,474 @@
+/*****************************************************************/
+/*                                                               */
+/*   Stages of the LUND pipeline: each event read in from a LUND */
+/*   file is handed to a list of stages in turn, so splitting    */
+/*   the file, filling a ROOT tree and counting events all come  */
+/*   out of a single read of the input.                          */
+/*                                                               */
+/*   Stages provided here:                                       */
+/*     OddBallCheck    flags events which don't look like what's */
+/*                     expected (ev.bad), for the stages after   */
+/*                     it to skip, and counts them               */
+/*     LundCounter     counts the events read in and the good    */
+/*                     ones                                      */
+/*     LundSplitter    writes the events to sets of LUND files,  */
+/*                     see lund_router.h                         */
+/*     GenEventWriter  fills the GenEvent tree, with the pi0     */
+/*                     mass in batches if asked for              */
+/*                                                               */
+/*   A macro makes a new list of stages for each file (or chunk  */
+/*   of a file) it reads, and run_lund_pipeline then reads them  */
+/*   in, one thread per file if asked for. Any stage that needs  */
+/*   something other than the event itself (eg. the cross-       */
+/*   section of the file) can be added the same way: derive from */
+/*   LundStage and fill in event().                              */
+/*                                                               */
+/*   Odd events are counted (see run_stats.h), and the counts    */
+/*   printed at the end of each file and of the run. With the    */
+/*   stage clocks on, the time spent in each stage is put down   */
+/*   to filling the tree or writing the LUND files, as set by    */
+/*   its "stage".                                                */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef LUND_STAGES_H
+#define LUND_STAGES_H
+
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "TFile.h"
+#include "TLorentzVector.h"
+#include "TTree.h"
+#include "file_list.h"
+#include "kinematics.h"
+#include "lund_reader.h"
+#include "lund_router.h"
+#include "run_stats.h"
+#include "tree_layout.h"
+
+
+struct LundStage {
+  int stage = STAGE_FILL;   // what its time counts as, with the stage clocks on
+  virtual ~LundStage() {}
+  virtual void begin_task(const FileTask &task, const char *filename) {}   // before the first event of the file (or chunk)
+  virtual void event(LundEvent &ev) = 0;                                    // each event, in file order
+  virtual void end_task() {}                                                // after the last one: close files
+  virtual void print_summary() {}                                           // then print what it found, see run_lund_pipeline
+};
+
+typedef std::vector<LundStage*> LundStages;
+
+
+// What the stages of one task counted, so the macro can add them up in list order once all the files are read.
+
+struct LundCounts {
+  long nread = 0;                // events read in
+  long ngood = 0;                // of which not flagged as bad
+  std::vector<long> nrouted;     // events written to each set of output files of the splitter
+  TaskStats stats;               // odd events, time spent in each stage, text read in
+};
+
+
+// Everything printed at the end of a task is printed in one go, so the summaries of files read at the same time don't get mixed up.
+
+inline std::mutex& lund_print_lock(){
+  static std::mutex lock;
+  return lock;
+}
+
+
+// Which file (or chunk of it) a task is about, for the printout:
+
+inline std::string task_name(const FileTask &task, const char *filename){
+  std::string name = filename;
+  if (!task.whole_file) name += " (chunk " + std::to_string(task.shard) + ")";
+  return name;
+}
+
+
+// Reads in each task with a LundReader and passes every event through the stages make_stages(t) gives for task t, which
+// are deleted once the task is done. With nthreads != 1 several tasks are read at the same time (see run_on_files).
+// What each task kept track of goes to counts[t].stats, with the time spent in each stage if timing is set.
+
+inline void run_lund_pipeline(const std::vector<std::string> &files, const std::vector<FileTask> &tasks, int nthreads,
+			      std::vector<LundCounts> &counts, bool timing, std::function<LundStages(int)> make_stages){
+
+  run_on_files(tasks.size(), nthreads, [&](int t){
+
+      const FileTask &task = tasks[t];
+      const char *filename = files[task.file].c_str();
+
+      std::cout << " Reading from file: " << task_name(task, filename) << std::endl;
+
+      TaskStats &stats = counts[t].stats;
+      LundStages stages = make_stages(t);
+      LundReader reader(filename);
+      LundEvent ev;   // re-used for every event
+      StageClock &clock = reader.clock;
+      clock.on = timing;
+
+      for (auto s : stages) s->begin_task(task, filename);
+
+      if (reader.open(task)){
+	clock.start();
+	while (reader.next(ev)){
+	  for (auto s : stages){
+	    s->event(ev);
+	    clock.lap(s->stage);
+	  }
+	}
+	if (reader.nmalformed > 0){
+	  std::lock_guard<std::mutex> lock(lund_print_lock());
+	  std::cout << "Odd-balls: " << reader.nmalformed << " events in " << filename << " don't have as many particles as their header says (or it gives an impossible number), skipped them." << std::endl;
+	}
+      }
+      else if (reader.input.compression == PLAIN_TEXT) std::cout << "Crap, no " <<  filename << " found!" << std::endl;   // otherwise TextInput has said why
+
+      // the output is finished off at the same time as the other tasks, only the printing is done one task at a time:
+      clock.start();
+      for (auto s : stages) s->end_task();
+      clock.lap(STAGE_WRITE);
+      {
+	std::lock_guard<std::mutex> lock(lund_print_lock());
+	for (auto s : stages) s->print_summary();
+	stats.odd.print("Odd-balls: ", ". Humpf!");
+      }
+      for (auto s : stages) delete s;
+
+      stats.clock.add(clock);
+      stats.nbytes = reader.input.nbytes;
+    });
+}
+
+
+// Adds up what was kept track of for each task, in list order, prints the speed of the run and the odd events found in all
+// the files, and adds the report to report_file if that's set. write_clock has the time the output took to be put together.
+
+inline void report_lund_run(RunReport &report, const std::vector<std::string> &files, const std::vector<FileTask> &tasks,
+			    const std::vector<LundCounts> &counts, const StageClock &write_clock, const char *report_file){
+
+  for (size_t t=0; t<counts.size(); t++){
+    report.nevents += counts[t].nread;
+    report.add(counts[t].stats, files[tasks[t].file]);
+  }
+  report.clock.add(write_clock);
+  report.finish();
+  report.print("Odd-balls: ", ". Humpf!");
+  if (report_file && report_file[0] != '\0') report.write_json(report_file);
+}
+
+
+// Flags bad events. The target particle given in the header has to be the active nucleon (the particle with index 3). With
+// dvmp set, the event also has to be pi0 DVMP on a nucleon in deuteron: electron, spectator nucleon, active nucleon, then two photons.
+// The bad events are counted in the stats of the task, by what's wrong with them.
+
+struct OddBallCheck : LundStage {
+  bool dvmp;
+  OddCounts &odd;
+  int not_electron, spectator_not_nucleon, other_active, active_not_nucleon, not_photon;   // counters in odd
+
+  OddBallCheck(bool dvmp_event, LundCounts &c) : dvmp(dvmp_event), odd(c.stats.odd) {
+    not_electron = odd.add("first particle isn't an electron");
+    spectator_not_nucleon = odd.add("second particle isn't a nucleon");
+    other_active = odd.add("specified target particle isn't the active nucleon");
+    active_not_nucleon = odd.add("third particle isn't a nucleon");
+    not_photon = odd.add("fourth or fifth particle isn't a photon");
+  }
+
+  static bool nucleon(int pid){ return pid == 2212 || pid == 2112; }
+
+  void found(int counter, LundEvent &ev, int pid){
+    ev.bad = 1;
+    if (odd.count(counter)) odd.first[counter] = "event number " + std::to_string(ev.number) + " (it's a " + std::to_string(pid) + ")";
+  }
+
+  void event(LundEvent &ev){
+    for (const auto &part : ev.particles){
+      int pid = part.pid();
+      switch (part.index()){
+      case 1:
+	if (dvmp && pid != 11) found(not_electron, ev, pid);
+	break;
+      case 2:
+	if (dvmp && !nucleon(pid)) found(spectator_not_nucleon, ev, pid);
+	break;
+      case 3:   // particle with index 3 in event is the active nucleon
+	if (pid != ev.target()) found(other_active, ev, pid);
+	else if (dvmp && !nucleon(pid)) found(active_not_nucleon, ev, pid);
+	break;
+      case 4:
+      case 5:
+	if (dvmp && pid != 22) found(not_photon, ev, pid);
+	break;
+      }
+    }
+  }
+};
+
+
+// Counts the events, and the good ones among them. If good_what is given, the counts are printed at the end of each file as
+// "Of these, <good_what>: ...".
+
+struct LundCounter : LundStage {
+  LundCounts &counts;
+  const char *good_what;
+  std::string name;
+
+  LundCounter(LundCounts &c, const char *good = nullptr) : counts(c), good_what(good) {}
+
+  void begin_task(const FileTask &task, const char *filename){
+    name = task_name(task, filename);
+  }
+
+  void event(LundEvent &ev){
+    counts.nread++;
+    if (!ev.bad) counts.ngood++;
+  }
+
+  void print_summary(){
+    std::cout << "\n In file " << name << ", number of events: " << counts.nread << std::endl;
+    if (good_what) std::cout << "\t Of these, " << good_what << ": " << counts.ngood << std::endl;
+  }
+};
+
+
+// Writes every event (bad or not) to the sets of files set up by set_up_routes, compressed if compression isn't PLAIN_TEXT.
+// Chunk s > 0 of a file goes to files of its own, which join_chunks adds to the end of the ones of chunk 0 once they're all
+// written.
+
+struct LundSplitter : LundStage {
+  LundRouter router;
+  LundCounts &counts;
+  int N = 0;
+  int unrouted;   // counter of the events which don't go to any of the files
+
+  LundSplitter(std::function<void(LundRouter&)> set_up_routes, LundCounts &c, int compression = PLAIN_TEXT, int level = -1) : counts(c) {
+    stage = STAGE_WRITE;
+    set_up_routes(router);
+    router.compression = compression;
+    router.level = level;
+    counts.nrouted.assign(router.routes.size(), 0);
+    unrouted = counts.stats.odd.add("event doesn't go to any of the output files");
+  }
+
+  void begin_task(const FileTask &task, const char *filename){
+    N = task.file;
+    router.open_files(task.file, task.shard);   // (re-)created, otherwise the events would be added to the end of the files if they already exist!
+  }
+
+  void event(LundEvent &ev){
+    if (router.route(ev) == 0 && counts.stats.odd.count(unrouted)) counts.stats.odd.first[unrouted] = "event number " + std::to_string(ev.number);
+  }
+
+  void end_task(){
+    router.close_files();
+    for (size_t r=0; r<router.routes.size(); r++) counts.nrouted[r] = router.routes[r]->nfile;
+  }
+
+  void print_summary(){
+    for (size_t r=0; r<router.routes.size(); r++){
+      std::cout << "\t Number of events written to " << route_file_name(router.routes[r]->name, N, 0, router.compression) << ": " << counts.nrouted[r] << std::endl;
+    }
+  }
+};
+
+
+// Events waiting for their kinematics to be worked out, with kinematics = 1: everything that goes into the GenEvent tree
+// for up to KINEMATICS_BATCH good events, and the pi0 masses computed from them in one go.
+
+struct GenEventBatch {
+  int n = 0;
+  std::vector<double> beamE, xsec, Mgg;
+  FourVectors electron, spectator, recoil, photon1, photon2;
+  std::vector<int> pid_recoil, pid_spect;
+
+  void resize(int size){
+    for (std::vector<double> *x : {&beamE, &xsec, &Mgg}) x->resize(size);
+    for (FourVectors *v : {&electron, &spectator, &recoil, &photon1, &photon2}) v->resize(size);
+    pid_recoil.resize(size);
+    pid_spect.resize(size);
+  }
+};
+
+
+// Variables for the GenEvent tree (called TCSevent in the file): the particle four-momenta of pi0 DVMP on a nucleon in deuteron,
+// the cross-section, the beam energy and the PID of the recoil and the spectator, and with kinematics = 1 the mass of the
+// two photons.
+
+struct GenEventBranches {
+  TTree *tree = nullptr;
+  double xsec = 0.;
+  double beamE = 0.;
+  TLorentzVector *electron = nullptr;
+  TLorentzVector *spectator = nullptr;
+  TLorentzVector *recoil = nullptr;
+  TLorentzVector *photon1 = nullptr;
+  TLorentzVector *photon2 = nullptr;
+  int pid_recoil = 0;
+  int pid_spect = 0;
+  double Mgg = 0.;
+  FourVectorColumns columns;   // how the four-momenta are written out
+  int kinematics = 0;
+  GenEventBatch batch;
+
+  // creates the tree in the current directory, with its branches pointing to the variables above, in the given layout
+  TTree* book(const TreeLayout &layout, int kin = 0){
+    tree = new TTree("TCSevent","generated TCS events");
+
+    columns.layout = layout;
+    tree->Branch("beamE",&beamE,"beamE/D");
+    tree->Branch("xsec",&xsec,"xsec/D");
+    columns.book(tree, "electron", electron);
+    columns.book(tree, "spectator", spectator);
+    columns.book(tree, "recoil", recoil);
+    columns.book(tree, "photon1", photon1);
+    columns.book(tree, "photon2", photon2);
+    tree->Branch("pid_recoil",&pid_recoil,"pid_recoil/I");
+    tree->Branch("pid_spect",&pid_spect,"pid_spect/I");
+
+    kinematics = kin;
+    if (kinematics == 1){
+      batch.resize(KINEMATICS_BATCH);
+      tree->Branch("Mgg",&Mgg,"Mgg/D");
+    }
+
+    tune_tree(tree, layout);
+
+    return tree;
+  }
+
+  // Fills the tree with the current event. With kinematics = 1 it's only added to the batch, which goes into the tree
+  // once it's full or flush() is called.
+  void fill(){
+    if (kinematics == 0){
+      columns.fill_tree();
+      return;
+    }
+
+    int i = batch.n++;
+    batch.beamE[i] = beamE;
+    batch.xsec[i] = xsec;
+    batch.electron.set(i, *electron);
+    batch.spectator.set(i, *spectator);
+    batch.recoil.set(i, *recoil);
+    batch.photon1.set(i, *photon1);
+    batch.photon2.set(i, *photon2);
+    batch.pid_recoil[i] = pid_recoil;
+    batch.pid_spect[i] = pid_spect;
+
+    if (batch.n == KINEMATICS_BATCH) flush();
+  }
+
+  // Works out Mgg for the events in the batch and fills the tree with them in order. The current event is left as it was,
+  // as the next one starts from it.
+  void flush(){
+    if (batch.n == 0) return;
+
+    batch_mass(batch.n, batch.photon1, batch.photon2, batch.Mgg.data());
+
+    double beamE_now = beamE, xsec_now = xsec;
+    TLorentzVector electron_now = *electron, spectator_now = *spectator, recoil_now = *recoil, photon1_now = *photon1, photon2_now = *photon2;
+    int pid_recoil_now = pid_recoil, pid_spect_now = pid_spect;
+
+    for (int i=0; i<batch.n; i++){
+      beamE = batch.beamE[i];
+      xsec = batch.xsec[i];
+      batch.electron.get(i, *electron);
+      batch.spectator.get(i, *spectator);
+      batch.recoil.get(i, *recoil);
+      batch.photon1.get(i, *photon1);
+      batch.photon2.get(i, *photon2);
+      pid_recoil = batch.pid_recoil[i];
+      pid_spect = batch.pid_spect[i];
+      Mgg = batch.Mgg[i];
+      columns.fill_tree();
+    }
+
+    beamE = beamE_now;
+    xsec = xsec_now;
+    *electron = electron_now;
+    *spectator = spectator_now;
+    *recoil = recoil_now;
+    *photon1 = photon1_now;
+    *photon2 = photon2_now;
+    pid_recoil = pid_recoil_now;
+    pid_spect = pid_spect_now;
+
+    batch.n = 0;
+  }
+};
+
+
+// Fills the GenEvent tree with the good events. In serial mode that's the output tree itself, in parallel mode a tree of
+// its own in the temporary file partname, to be appended to the output tree afterwards (see append_parts).
+// A particle which is missing from an event, or isn't what it should be, keeps its four-momentum from the event before.
+
+struct GenEventWriter : LundStage {
+  GenEventBranches *out;
+  GenEventBranches own;
+  std::string partname;
+  TreeLayout layout;
+  int kinematics = 0;
+  TFile *partfile = nullptr;
+
+  GenEventWriter(GenEventBranches &shared) : out(&shared) {}
+  GenEventWriter(const std::string &part, const TreeLayout &l, int kin = 0) : out(&own), partname(part), layout(l), kinematics(kin) {}
+
+  void begin_task(const FileTask &task, const char *filename){
+    if (partname.empty()) return;
+    partfile = new TFile(partname.c_str(), "RECREATE");
+    set_compression(partfile, layout);   // the same as the output file, so the part can be copied over as it is
+    own.book(layout, kinematics);
+  }
+
+  void event(LundEvent &ev){
+
+    out->beamE = ev.dvar[0];
+    out->xsec = ev.dvar[1];
+
+    for (const auto &part : ev.particles){
+      int pid = part.pid();
+      const double *dp = part.dpar;
+      switch (part.index()){
+      case 1:
+	if (pid == 11) out->electron->SetPxPyPzE(dp[0],dp[1],dp[2],dp[3]);
+	break;
+      case 2:
+	if (OddBallCheck::nucleon(pid)){
+	  out->spectator->SetPxPyPzE(dp[0],dp[1],dp[2],dp[3]);
+	  out->pid_spect = pid;
+	}
+	break;
+      case 3:
+	if (pid == ev.target() && OddBallCheck::nucleon(pid)){
+	  out->recoil->SetPxPyPzE(dp[0],dp[1],dp[2],dp[3]);
+	  out->pid_recoil = pid;
+	}
+	break;
+      case 4:
+	if (pid == 22) out->photon1->SetPxPyPzE(dp[0],dp[1],dp[2],dp[3]);
+	break;
+      case 5:
+	if (pid == 22) out->photon2->SetPxPyPzE(dp[0],dp[1],dp[2],dp[3]);
+	break;
+      }
+    }
+
+    if (!ev.bad) out->fill();
+  }
+
+  void end_task(){
+    out->flush();   // the events of this file still waiting for their kinematics
+    if (!partfile) return;
+    partfile->cd();
+    own.tree->Write();
+    partfile->Close();
+    delete partfile;
+    partfile = nullptr;
+  }
+};
+
+#endif
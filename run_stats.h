@@ -0,0 +1,203 @@
+/*****************************************************************/
+/*                                                               */
+/*   What the converters keep track of while they run, to be     */
+/*   summed up at the end rather than printed as they go:        */
+/*                                                               */
+/*     OddCounts   counters of events that aren't what's         */
+/*                 expected (a particle with the wrong pid...),  */
+/*                 with where each was found the first time.     */
+/*                 Counting costs an increment per odd event.    */
+/*     StageClock  time spent reading the text in, turning it    */
+/*                 into numbers, filling the trees (or LUND      */
+/*                 files) and writing them out. It's only on     */
+/*                 with stage_timing = 1, as it reads the clock  */
+/*                 a few times per line.                         */
+/*     RunReport   the events/s, MB/s and peak memory of a whole */
+/*                 run, printed at the end, and added as a line  */
+/*                 of JSON to report_file if that's set (see     */
+/*                 bench_converters.C).                          */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef RUN_STATS_H
+#define RUN_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+enum { STAGE_READ = 0, STAGE_TOKENIZE = 1, STAGE_FILL = 2, STAGE_WRITE = 3, NSTAGES = 4 };
+
+inline const char* stage_name(int stage){
+  static const char *names[NSTAGES] = {"read", "tokenize", "fill", "write"};
+  return names[stage];
+}
+
+
+// Time spent in each stage. lap(stage) puts the time since the last lap (or start) down to that stage, so each switch from
+// one stage to the next costs one reading of the clock -- and nothing but a test of "on" when it's off.
+
+struct StageClock {
+  bool on = false;
+  double seconds[NSTAGES] = {};
+  std::chrono::steady_clock::time_point last;
+
+  void start(){
+    if (on) last = std::chrono::steady_clock::now();
+  }
+
+  void lap(int stage){
+    if (!on) return;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    seconds[stage] += std::chrono::duration<double>(now - last).count();
+    last = now;
+  }
+
+  void add(const StageClock &other){
+    on = on || other.on;
+    for (int s=0; s<NSTAGES; s++) seconds[s] += other.seconds[s];
+  }
+};
+
+
+// Counters of odd events, eg. for set_particle in parse_hepmc.C:
+//   int wrong_beam = odd.add("First particle doesn't seem to be a beam electron");
+//   ...
+//   if (pid != 11 && odd.count(wrong_beam)) odd.first[wrong_beam] = "event " + std::to_string(n);
+
+struct OddCounts {
+  std::vector<std::string> what;    // what each counter counts
+  std::vector<long> n;              // how many times it's been found
+  std::vector<std::string> first;   // where it was found the first time
+
+  int add(const std::string &description){
+    what.push_back(description);
+    n.push_back(0);
+    first.push_back("");
+    return what.size() - 1;
+  }
+
+  // counts one more, and returns true if it's the first one, for the caller to say where it was in first[i]
+  bool count(int i){
+    return n[i]++ == 0;
+  }
+
+  long total() const {
+    long sum = 0;
+    for (long k : n) sum += k;
+    return sum;
+  }
+
+  // adds up the counters of another file (or chunk of one), keeping the first example found, with "of <where>" added to it
+  void merge(const OddCounts &other, const std::string &where = ""){
+    for (size_t j=0; j<other.what.size(); j++){
+      size_t i = 0;
+      while (i < what.size() && what[i] != other.what[j]) i++;
+      if (i == what.size()) add(other.what[j]);
+      if (n[i] == 0 && other.n[j] > 0) first[i] = where.empty() ? other.first[j] : other.first[j] + " of " + where;
+      n[i] += other.n[j];
+    }
+  }
+
+  // eg. "Weird! First particle doesn't seem to be a beam electron: 3 times, first in event 5 (pid 22, code 1)"
+  void print(const std::string &prefix, const std::string &suffix = "") const {
+    for (size_t i=0; i<what.size(); i++){
+      if (n[i] == 0) continue;
+      std::cout << prefix << what[i] << ": " << n[i] << (n[i] == 1 ? " time" : " times");
+      if (!first[i].empty()) std::cout << ", first in " << first[i];
+      std::cout << suffix << std::endl;
+    }
+  }
+};
+
+
+// What's been kept track of while reading one file, or one chunk of it.
+
+struct TaskStats {
+  OddCounts odd;
+  StageClock clock;
+  uint64_t nbytes = 0;   // bytes of text read in (once decompressed)
+};
+
+
+// Highest memory use of the process so far, in MB.
+
+inline double peak_rss_mb(){
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.;
+#ifdef __APPLE__
+  return usage.ru_maxrss/1.e6;      // in bytes
+#else
+  return usage.ru_maxrss*1024/1.e6; // in kB
+#endif
+}
+
+
+// Speed and memory of a whole run of a converter, with the counters and stage times of all its files added up (the stage
+// times are summed over the threads, so with nthreads > 1 they add up to more than the time the run took).
+
+struct RunReport {
+  std::string converter;
+  int nfiles = 0;
+  int nthreads = 1;
+  long nevents = 0;       // events read in
+  uint64_t nbytes = 0;    // bytes of text read in
+  double seconds = 0.;    // time the whole run took
+  double rss_mb = 0.;     // peak memory
+  OddCounts odd;
+  StageClock clock;
+  std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+
+  RunReport(const char *name, int files, int threads) : converter(name), nfiles(files), nthreads(threads) {}
+
+  // in list order, so the first odd event of each kind is the first one in the list, with the name of its file
+  void add(const TaskStats &stats, const std::string &filename){
+    odd.merge(stats.odd, filename);
+    clock.add(stats.clock);
+    nbytes += stats.nbytes;
+  }
+
+  // once the output is written
+  void finish(){
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    rss_mb = peak_rss_mb();
+  }
+
+  double events_per_second() const { return seconds > 0. ? nevents/seconds : 0.; }
+  double mb_per_second() const { return seconds > 0. ? nbytes/1.e6/seconds : 0.; }
+
+  void print(const std::string &odd_prefix, const std::string &odd_suffix = "") const {
+    printf("\n Converted %ld events (%.1f MB of text) in %.2f s: %.0f events/s, %.1f MB/s, peak memory %.0f MB\n",
+	   nevents, nbytes/1.e6, seconds, events_per_second(), mb_per_second(), rss_mb);
+    if (clock.on){
+      printf(" Time spent");
+      for (int s=0; s<NSTAGES; s++) printf("%s %s %.3f s", s == 0 ? "" : ",", stage_name(s), clock.seconds[s]);
+      printf("%s\n", nthreads != 1 ? " (summed over the threads)" : "");
+    }
+    if (odd.total() > 0){
+      std::cout << " In all the files:" << std::endl;
+      odd.print(odd_prefix, odd_suffix);
+    }
+  }
+
+  // adds the report as one line of JSON to the end of the file
+  bool write_json(const char *filename) const {
+    FILE *f = fopen(filename, "a");
+    if (!f){
+      std::cout << "Crap, can't write to " << filename << "!" << std::endl;
+      return false;
+    }
+    fprintf(f, "{\"converter\":\"%s\",\"files\":%d,\"nthreads\":%d,\"events\":%ld,\"text_mb\":%.6f,\"seconds\":%.6f,"
+	    "\"events_per_s\":%.1f,\"mb_per_s\":%.3f,\"peak_rss_mb\":%.1f,\"odd_events\":%ld",
+	    converter.c_str(), nfiles, nthreads, nevents, nbytes/1.e6, seconds, events_per_second(), mb_per_second(), rss_mb, odd.total());
+    if (clock.on) for (int s=0; s<NSTAGES; s++) fprintf(f, ",\"%s_s\":%.6f", stage_name(s), clock.seconds[s]);
+    fprintf(f, "}\n");
+    return fclose(f) == 0;
+  }
+};
+
+#endif
@@ -0,0 +1,169 @@
+/*****************************************************************/
+/*                                                               */
+/*   How the event trees are laid out in the output ROOT files:  */
+/*   the schema of the particle four-momenta, and the            */
+/*   compression and buffering settings of the file and tree.    */
+/*                                                               */
+/*   Schemas:                                                    */
+/*     OBJECT_SCHEMA  one TLorentzVector branch per particle     */
+/*                    (eg. "ebeam"), as the macros have always   */
+/*                    written them.                              */
+/*     FLAT_SCHEMA    four plain leaves per particle:            */
+/*                    ebeam_px, ebeam_py, ebeam_pz, ebeam_E.     */
+/*     ARRAY_SCHEMA   one fixed-size array leaf per particle,    */
+/*                    ebeam[4] = {px, py, pz, E}.                */
+/*   The flat and array leaves are doubles, or floats with       */
+/*   float_leaves. They need no dictionary to be read back, so   */
+/*   RDataFrame (or a plain TTree loop) gets the numbers as      */
+/*   columns without building a TLorentzVector for each event.   */
+/*                                                               */
+/*   The macros keep filling TLorentzVectors whatever the        */
+/*   schema; FourVectorColumns copies them into the leaves just  */
+/*   before each tree->Fill().                                   */
+/*                                                               */
+/*****************************************************************/
+
+#ifndef TREE_LAYOUT_H
+#define TREE_LAYOUT_H
+
+#include <string>
+#include <vector>
+#include "TFile.h"
+#include "TLorentzVector.h"
+#include "TTree.h"
+
+enum { OBJECT_SCHEMA = 0, FLAT_SCHEMA = 1, ARRAY_SCHEMA = 2 };
+
+
+// The settings, as set in the CUSTOMISE! block of the macros:
+
+struct TreeLayout {
+  int schema = OBJECT_SCHEMA;
+  int float_leaves = 0;            // 1: flat and array leaves are floats rather than doubles
+  int compression_algorithm = 0;   // 0: ROOT's default, 1: zlib, 2: LZMA, 4: LZ4, 5: ZSTD
+  int compression_level = -1;      // 0 (none) to 9, -1: the usual level for the algorithm
+  int basket_size = 0;             // buffer size of each branch in bytes, 0: ROOT's default
+  long auto_flush = 0;             // > 0: baskets written out every auto_flush entries, < 0: every -auto_flush bytes, 0: ROOT's default
+};
+
+
+// The layout set at the top of a converter macro (schema, float_leaves, compression_algorithm, compression_level,
+// basket_size and auto_flush), which each of them passes in as it is.
+
+inline TreeLayout make_tree_layout(int schema, int float_leaves, int compression_algorithm, int compression_level,
+				   int basket_size, long auto_flush){
+  TreeLayout layout;
+  layout.schema = schema;
+  layout.float_leaves = float_leaves;
+  layout.compression_algorithm = compression_algorithm;
+  layout.compression_level = compression_level;
+  layout.basket_size = basket_size;
+  layout.auto_flush = auto_flush;
+  return layout;
+}
+
+
+// Compression of everything written to the file from now on. To be called before the trees are created.
+
+inline void set_compression(TFile *file, const TreeLayout &layout){
+
+  if (layout.compression_algorithm == 0){
+    if (layout.compression_level >= 0) file->SetCompressionLevel(layout.compression_level);
+    return;
+  }
+
+  int level = layout.compression_level;
+  if (level < 0){   // ROOT's own default levels for each algorithm
+    if (layout.compression_algorithm == 2) level = 7;        // LZMA
+    else if (layout.compression_algorithm == 4) level = 4;   // LZ4
+    else if (layout.compression_algorithm == 5) level = 5;   // ZSTD
+    else level = 1;
+  }
+  file->SetCompressionSettings(100*layout.compression_algorithm + level);
+}
+
+
+// Basket size and auto-flush of a tree. To be called once all its branches are booked.
+
+inline void tune_tree(TTree *tree, const TreeLayout &layout){
+  if (layout.basket_size > 0) tree->SetBasketSize("*", layout.basket_size);
+  if (layout.auto_flush != 0) tree->SetAutoFlush(layout.auto_flush);
+}
+
+
+// The four-momentum branches of a tree, in whichever schema.
+
+struct FourVectorColumn {
+  std::string name;
+  TLorentzVector **v;   // the four-momentum the macro fills
+  double d[4];          // px, py, pz, E as written out
+  float f[4];
+};
+
+
+struct FourVectorColumns {
+  TreeLayout layout;
+  TTree *tree = nullptr;
+  std::vector<FourVectorColumn*> columns;
+  std::vector<TLorentzVector*> owned;   // four-momenta not handed over to ROOT, ie. not in OBJECT_SCHEMA
+
+  FourVectorColumns() = default;
+  FourVectorColumns(const FourVectorColumns&) = delete;              // it owns the columns, whose addresses the tree's
+  FourVectorColumns& operator=(const FourVectorColumns&) = delete;   // branches point to: they can't be copied
+
+  // Books the branch(es) of the four-momentum v, called name. v is created if it isn't already.
+  void book(TTree *t, const char *name, TLorentzVector *&v){
+
+    tree = t;
+
+    if (layout.schema == OBJECT_SCHEMA){
+      tree->Branch(name,"TLorentzVector",&v);
+      return;
+    }
+
+    if (!v){
+      v = new TLorentzVector();
+      owned.push_back(v);
+    }
+
+    FourVectorColumn *c = new FourVectorColumn;
+    c->name = name;
+    c->v = &v;
+    columns.push_back(c);
+
+    std::string type = layout.float_leaves ? "/F" : "/D";
+
+    if (layout.schema == ARRAY_SCHEMA){
+      if (layout.float_leaves) tree->Branch(name, c->f, (c->name + "[4]" + type).c_str());
+      else tree->Branch(name, c->d, (c->name + "[4]" + type).c_str());
+      return;
+    }
+
+    const char *component[4] = {"_px", "_py", "_pz", "_E"};
+    for (int i=0; i<4; i++){
+      std::string leaf = c->name + component[i];
+      if (layout.float_leaves) tree->Branch(leaf.c_str(), &c->f[i], (leaf + type).c_str());
+      else tree->Branch(leaf.c_str(), &c->d[i], (leaf + type).c_str());
+    }
+  }
+
+  // Copies the four-momenta into the leaves and fills the tree with the event.
+  int fill_tree(){
+    for (auto c : columns){
+      const TLorentzVector *v = *c->v;
+      c->d[0] = v->Px();
+      c->d[1] = v->Py();
+      c->d[2] = v->Pz();
+      c->d[3] = v->E();
+      if (layout.float_leaves) for (int i=0; i<4; i++) c->f[i] = c->d[i];
+    }
+    return tree->Fill();
+  }
+
+  ~FourVectorColumns(){
+    for (auto c : columns) delete c;
+    for (auto v : owned) delete v;
+  }
+};
+
+#endif